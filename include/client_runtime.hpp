@@ -1,7 +1,10 @@
 #ifndef __PROJ_CLIENT_RUNTIME_H__
 #define __PROJ_CLIENT_RUNTIME_H__
 
+#include <chrono>
+#include <future>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <thread>
@@ -14,49 +17,149 @@
 
 #include "../src/graph_types.hpp" //Could probably just forward declare struct application
 #include "../src/stats.hpp"
+#include "../src/completion_ring.hpp"
+#include "../src/shard_map.hpp"
+#include "../src/index_table.hpp"
+#include "../src/numa_placement.hpp"
+#include "../src/rdma_arena.hpp"
+#include "messages.hpp"
 
 void run_client(boost::program_options::variables_map& vm);
 
+// One memory server, holding a shard of the edge array, and the control connection to
+// it. Server i serves shard i.
+struct memory_server
+{
+    std::string host;
+    std::string port;
+    struct addrinfo *addr{nullptr};
+    rdma_cm_id* control_id{nullptr};
+
+    struct message *tx_msg{nullptr};
+    struct ibv_mr *tx_msg_mr{nullptr};
+
+    struct message *rx_msg{nullptr};
+    struct ibv_mr *rx_msg_mr{nullptr};
+
+    bool has_mr{false}; // its MSG_CATALOG has arrived
+    bool done{false}; // its MSG_DONE has arrived
+
+    // what its catalog lists for the graph this job runs on
+    std::vector<named_region> regions;
+    uint32_t num_vertices{0}; // 0 if it has no index
+    uint32_t max_out_degree{0};
+};
+
 struct client_context
 {
     famgraph::FG_stats stats;
     
     struct ibv_pd *pd;
-    
-    struct message *tx_msg;
-    struct ibv_mr *tx_msg_mr;
 
-    struct message *rx_msg;
-    struct ibv_mr *rx_msg_mr;
+    // with --rdma-heap-mb, where registered buffers are carved from, see
+    // init_rdma_heap(); declared early so it outlives everything allocated from it
+    std::unique_ptr<famgraph::rdma_arena> heap;
 
     struct ibv_mr *heap_mr;
 
-    uint64_t peer_addr;
+    std::vector<memory_server> servers;
+    famgraph::shard_map shards; // where each part of the edge array lives
+
+    uint64_t peer_addr; // server 0's shard
     uint32_t peer_rkey;
 
+    uint64_t peer_in_addr{0}; // transposed edge array, if a server loaded one
+    uint32_t peer_in_rkey{0};
+    uint64_t num_in_edges{0};
+    uint32_t in_edge_server{0}; // which server holds it
+    uint32_t gather_bytes{0}; // largest gather reply every server builds, 0 if none
+
     std::string index_file;
     std::string kernel;
     std::string ofile;
 
-    struct addrinfo *addr;
-    rdma_cm_id* base_id;
-    std::vector<rdma_cm_id*> cm_ids;
+    unsigned long const workers;
+    unsigned long const qps_per_worker; // lanes a worker spreads its windows over
+    std::vector<rdma_cm_id*> cm_ids; // data QPs, see data_qp() and state_qp()
+    std::vector<famgraph::completion_ring> rings; // one per cm_id
     unsigned long conns_established {0};
     unsigned long const connections;
     bool const print_vtable;
     boost::program_options::variables_map * const vm;
     
     std::thread app_thread;
-    std::vector<std::thread> comm_threads;
     
     std::unique_ptr<famgraph::application> app;
     uint64_t num_edges{0};
 
-    client_context(std::string const& t_file, unsigned long const t_num_conns, std::string const& t_kernel,
-                   std::string const& t_ofile, bool const t_print_vtable, boost::program_options::variables_map * const t_vm)
-        :index_file(t_file), kernel(t_kernel), ofile(t_ofile), cm_ids(t_num_conns), connections(t_num_conns), print_vtable(t_print_vtable), vm(t_vm) {}
+    std::promise<std::pair<uint64_t, uint32_t>> state_region; // addr, rkey
+
+    // the .idx is loaded while the data QPs connect, see on_completion
+    std::future<famgraph::index_table> index_load;
+    std::chrono::steady_clock::time_point const started{std::chrono::steady_clock::now()};
+
+    // with --numa-aware, where the workers run; null otherwise
+    std::unique_ptr<famgraph::numa_placement> numa;
+    std::unique_ptr<famgraph::worker_pinning> pinning;
+
+    client_context(std::string const& t_file, std::vector<memory_server> t_servers,
+                   unsigned long const t_num_workers,
+                   unsigned long const t_qps_per_worker, bool const t_remote_state,
+                   std::string const& t_kernel,
+                   std::string const& t_ofile, bool const t_print_vtable,
+                   boost::program_options::variables_map * const t_vm)
+        :servers(std::move(t_servers)), index_file(t_file), kernel(t_kernel),
+         ofile(t_ofile), workers(t_num_workers), qps_per_worker(t_qps_per_worker),
+         cm_ids(t_num_workers * t_qps_per_worker * servers.size()
+                + (t_remote_state ? 1 : 0)),
+         rings(cm_ids.size()),
+         connections(cm_ids.size()), print_vtable(t_print_vtable), vm(t_vm) {}
+
+    // Each worker has qps_per_worker lanes, each with one data QP to every server,
+    // indexed into cm_ids and rings. The QPs of a lane are adjacent, in server order.
+    size_t data_qp(size_t const worker, size_t const server,
+                   size_t const lane = 0) const noexcept
+    {
+        return (worker * qps_per_worker + lane) * servers.size() + server;
+    }
+
+    // With remote vertex state, one more QP to server 0 carries its reads and writes
+    // for all workers.
+    size_t state_qp() const noexcept
+    {
+        return workers * qps_per_worker * servers.size();
+    }
+
+    // Blocks until every QP is connected. Called from the application thread, so
+    // the QPs connect while the index loads.
+    void wait_for_connections() const;
+
+    // The first server listing a region called name, and that region; null if none
+    // does.
+    std::pair<uint32_t, named_region const *> find_region(std::string const& name) const
+    {
+        for (size_t s = 0; s < servers.size(); ++s) {
+            for (auto const &r : servers[s].regions) {
+                if (name == r.name) return {static_cast<uint32_t>(s), &r};
+            }
+        }
+        return {0, nullptr};
+    }
+
+    // The server whose control connection is id.
+    memory_server & server_of(rdma_cm_id const * const id)
+    {
+        for (auto &s : servers) {
+            if (s.control_id == id) return s;
+        }
+        throw std::runtime_error("not a control connection");
+    }
 
     void finish_application();
+
+    // Asks server 0 for a zeroed region of bytes for vertex state and blocks until it
+    // is registered. Called from the application thread.
+    std::pair<uint64_t, uint32_t> request_state_region(uint64_t bytes);
     
     client_context & operator=(const client_context&) = delete;
     client_context(const client_context&) = delete;
@@ -2,6 +2,7 @@
 #define RDMA_CONNECTION_UTILS_H
 
 #include <netdb.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,13 +18,27 @@ typedef void (*completion_cb_fn)(struct ibv_wc *wc);
 typedef void (*disconnect_cb_fn)(struct rdma_cm_id *id);
 
 void rc_init(pre_conn_cb_fn, connect_cb_fn, completion_cb_fn, disconnect_cb_fn);
-void rc_client_loop(const char *host, const char *port, struct client_context* context);
+void rc_set_data_connect_cb(connect_cb_fn); // runs for every data QP once established
+void rc_client_loop(struct client_context* context);
 void rc_disconnect(struct rdma_cm_id *id);
 void rc_die(const char *message);
 struct ibv_pd * rc_get_pd();
 unsigned long rc_get_num_connections();
 
-void rc_server_loop(const char *port);
+// What the RDMA device allows a connection, queried once when the device is opened.
+// All zero before that.
+struct rc_link_caps
+{
+    uint8_t initiator_depth; // RDMA READs a QP may have outstanding
+    uint8_t responder_resources; // RDMA READs a QP may serve at once
+    uint32_t max_send_wr; // send queue depth of a data QP
+    uint32_t control_cqe; // size of the control CQ
+    uint32_t active_mtu; // bytes
+};
+rc_link_caps rc_get_link_caps();
+
+void rc_server_bind(const char *port);
+void rc_server_loop();
 
 constexpr int TIMEOUT_IN_MS = 500;
 
@@ -3,12 +3,84 @@
 
 const size_t BUFFER_SIZE = 10 * 1024 * 1024;
 
+// Gather RPC, carried on a worker's data QP. The client SENDs a gather_request naming
+// up to GATHER_MAX_EXTENTS byte ranges of the server's edge arrays; a server pool
+// thread copies them back to back and writes them to reply_addr with a single
+// RDMA_WRITE_WITH_IMM whose immediate data is seq.
+const uint32_t GATHER_MAX_EXTENTS = 1024;
+const uint32_t GATHER_SLOTS = 16; // receives posted per data QP on each side
+
+struct gather_extent
+{
+    uint64_t addr;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct gather_request
+{
+    uint64_t reply_addr;
+    uint32_t reply_rkey;
+    uint32_t seq;
+    uint32_t count;
+    uint32_t bytes;
+    gather_extent extents[GATHER_MAX_EXTENTS]; // only the first count are sent
+};
+
+// One graph served by a memory server: its registered edge array, and the transposed
+// one if loaded.
+struct graph_region
+{
+    uint64_t addr;
+    uint32_t rkey;
+    uint64_t total_edges; // held by this server
+    uint64_t first_edge; // index of this server's first edge in the graph
+    uint64_t graph_edges; // edges in the whole graph
+    // transposed (in-edge) array, total_in_edges == 0 if not loaded
+    uint64_t in_addr;
+    uint32_t in_rkey;
+    uint64_t total_in_edges;
+    uint32_t gather_bytes; // largest gather reply served, 0 if none
+};
+
+const uint32_t CATALOG_MAX = 16; // graphs one server can preload
+const uint32_t GRAPH_NAME_MAX = 32; // including the terminating zero
+
+// Sent first in every catalog, and checked by the client. Change it whenever struct
+// message changes; the high half tells it apart from an older server's graph count.
+const uint32_t PROTOCOL_VERSION = 0x46470002;
+
+const uint32_t REGIONS_MAX = 8; // named regions per graph
+const uint32_t REGION_NAME_MAX = 16; // including the terminating zero
+
+// A registered array of a graph that clients may read: "edges", "in-edges" and
+// "weights" hold the server's shard, "index" and "in-index" are whole .idx files.
+struct named_region
+{
+    char name[REGION_NAME_MAX];
+    uint64_t addr;
+    uint64_t bytes;
+    uint32_t rkey;
+};
+
+struct catalog_entry
+{
+    char name[GRAPH_NAME_MAX];
+    graph_region region;
+    // from the graph's index, both 0 if the server has none
+    uint32_t num_vertices;
+    uint32_t max_out_degree;
+    uint32_t region_count;
+    named_region regions[REGIONS_MAX];
+};
+
 enum message_id
     {
         MSG_INVALID = 0,
-        MSG_MR,
+        MSG_CATALOG, // server lists its graphs when a client connects
         MSG_READY,
-        MSG_DONE
+        MSG_DONE,
+        MSG_STATE // client asks for, and server returns, a region for vertex state
     };
 
 struct message
@@ -19,10 +91,16 @@ struct message
     {
         struct
         {
+            uint32_t version; // PROTOCOL_VERSION
+            uint32_t count;
+            catalog_entry graphs[CATALOG_MAX];
+        } catalog;
+        struct
+        {
+            uint64_t bytes;
             uint64_t addr;
             uint32_t rkey;
-            uint64_t total_edges;
-        } mr;
+        } state;
     } data;
 };
 
@@ -3,5 +3,7 @@
 
 #include <client_runtime.hpp> //for struct client_context
 
+// Registers the --rdma-heap-mb region and installs it, so that RDMA_mmap_unique and
+// the control message buffers allocate from it. Does nothing if the option is 0.
 void init_rdma_heap(struct client_context * ctx);
 #endif // __PROJ_TCMALLOC_EXTENSIONS_H__
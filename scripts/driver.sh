@@ -9,6 +9,7 @@ COMPUTE_SERVER_IPoIB="192.168.12.2"
 THREADS=${THREADS:-"10"} 
 HP=${HP:-"--hp"} 
 DB=${DB:-""}
+FETCH=${FETCH:-""}
 NET_SCRATCH="/net/netscratch/fam-graph"
 COMPUTE_GRAPH_DIR=$NET_SCRATCH
 SERVER_GRAPH_DIR=$NET_SCRATCH
@@ -34,7 +35,7 @@ START_CLIENT() {
     # $1 APP
     # $2 INPUT twitter7-undirected
     # $3 extra options
-    clush -w $COMPUTE_SERVER "source .profile > /dev/null; ${REMOTE_DIR}main -m client -a $MEMORY_SERVER_IPoIB -k $1 -i $COMPUTE_GRAPH_DIR/$2.idx -t $THREADS $HP $DB $NUMA $3" | tee $OUTDIR/$1-$2.txt
+    clush -w $COMPUTE_SERVER "source .profile > /dev/null; ${REMOTE_DIR}main -m client -a $MEMORY_SERVER_IPoIB -k $1 -i $COMPUTE_GRAPH_DIR/$2.idx -t $THREADS $HP $DB $FETCH $NUMA $3" | tee $OUTDIR/$1-$2.txt
     local TIME=$( cat $OUTDIR/$1-$2.txt | perl -nle 'm/Running Time\(s\): ([-+]?[0-9]*\.?[0-9]+)/ and print $1;')
     local SPIN_TIME=$( cat $OUTDIR/$1-$2.txt | perl -nle 'm/Total Spin Time \(s\): ([-+]?[0-9]*\.?[0-9]+)/ and print $1;')
     local FUNCTION_TIME=$( cat $OUTDIR/$1-$2.txt | perl -nle 'm/Total Function Time \(s\) ([-+]?[0-9]*\.?[0-9]+)/ and print $1;')
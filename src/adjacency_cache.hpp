@@ -0,0 +1,213 @@
+#ifndef __PROJ_ADJACENCY_CACHE_H__
+#define __PROJ_ADJACENCY_CACHE_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#include <tbb/concurrent_hash_map.h>
+#pragma GCC diagnostic pop
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <infiniband/verbs.h>
+#include <boost/log/trivial.hpp>
+
+#include "mmap_util.hpp"
+#include "stats.hpp"
+
+namespace famgraph {
+// Keeps the adjacency lists of frequently fetched high-degree vertices in registered
+// client memory, so iterative kernels stop re-reading their hubs every round.
+//
+// The set of cached vertices only changes between rounds (end_round). During a round
+// the lookup table is read-only: a vertex is either valid (served from the arena),
+// reserved (its list is copied into the arena when it next arrives over RDMA), or
+// absent (its fetches are counted towards admission). Admission and eviction rank
+// vertices by degree * frequency, an estimate of the bytes a slot saves per round,
+// with frequency decaying by half every round.
+class adjacency_cache
+{
+  struct entry
+  {
+    uint32_t v;
+    uint32_t degree;
+    uint64_t offset;// into arena, in edges
+    uint32_t freq{ 0 };// decayed fetch count from earlier rounds
+    std::atomic<uint32_t> touches{ 0 };// fetches this round
+    std::atomic<uint32_t> filled{ 0 };// edges copied in so far
+    bool valid{ false };
+
+    entry(uint32_t t_v, uint32_t t_degree, uint64_t t_offset, uint32_t t_freq)
+      : v{ t_v }, degree{ t_degree }, offset{ t_offset }, freq{ t_freq }
+    {}
+  };
+
+  struct candidate
+  {
+    uint32_t freq;// decayed fetch count
+    uint32_t degree;
+  };
+
+  uint64_t const capacity;// in edges
+  uint32_t const min_degree;
+  std::unique_ptr<uint32_t, RDMA_mmap_deleter> arena;
+  std::vector<std::unique_ptr<entry>> entries;// sorted by v
+  tbb::concurrent_hash_map<uint32_t, candidate> candidates;
+  FG_stats &stats;
+
+  entry *find(uint32_t const v) const noexcept
+  {
+    auto it = std::lower_bound(entries.begin(),
+      entries.end(),
+      v,
+      [](std::unique_ptr<entry> const &e, uint32_t const x) { return e->v < x; });
+    return it != entries.end() && (*it)->v == v ? it->get() : nullptr;
+  }
+
+public:
+  adjacency_cache(uint64_t const budget_bytes,
+    uint32_t const t_min_degree,
+    ibv_pd *pd,
+    bool const use_HP,
+    FG_stats &t_stats)
+    : capacity{ budget_bytes / sizeof(uint32_t) },
+      min_degree{ std::max(t_min_degree, 1u) },
+      arena{ RDMA_mmap_unique<uint32_t>(capacity, pd, use_HP) }, stats{ t_stats }
+  {}
+
+  adjacency_cache &operator=(const adjacency_cache &) = delete;
+  adjacency_cache(const adjacency_cache &) = delete;
+
+  // Called while packing a window. Returns v's cached list, or nullptr if it has to be
+  // fetched.
+  uint32_t *lookup(uint32_t const v, uint32_t const degree) noexcept
+  {
+    if (degree < min_degree) return nullptr;
+
+    auto &s = stats.adj_cache.local();
+    ++std::get<0>(s);
+    if (auto *e = find(v)) {
+      e->touches.fetch_add(1, std::memory_order_relaxed);
+      if (e->valid) {
+        ++std::get<1>(s);
+        std::get<2>(s) += uint64_t{ degree } * sizeof(uint32_t);
+        return arena.get() + e->offset;
+      }
+      return nullptr;
+    }
+
+    tbb::concurrent_hash_map<uint32_t, candidate>::accessor a;
+    candidates.insert(a, v);
+    ++a->second.freq;
+    a->second.degree = degree;
+    return nullptr;
+  }
+
+  // Called when edges [start, start + n) of v's list have landed in a window. Copies
+  // them into the arena if v has a reserved slot.
+  void fill(uint32_t const v,
+    uint32_t const degree,
+    uint32_t const *const edges,
+    uint32_t const start,
+    uint32_t const n) noexcept
+  {
+    if (degree < min_degree) return;
+    if (auto *e = find(v); e && !e->valid) {
+      std::memcpy(arena.get() + e->offset + start, edges, n * sizeof(uint32_t));
+      e->filled.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  // Re-ranks cached and candidate vertices and lays out the arena for the next round.
+  // Runs on the application thread between rounds.
+  void end_round()
+  {
+    struct ranked
+    {
+      uint32_t v;
+      uint32_t degree;
+      uint32_t freq;
+      entry *e;
+    };
+    std::vector<ranked> pool;
+    pool.reserve(entries.size() + candidates.size());
+
+    for (auto &e : entries) {
+      if (!e->valid && e->filled.load(std::memory_order_relaxed) == e->degree) {
+        e->valid = true;
+      }
+      auto const freq = e->freq / 2 + e->touches.load(std::memory_order_relaxed);
+      pool.push_back({ e->v, e->degree, freq, e.get() });
+    }
+    for (auto const &[v, c] : candidates) {
+      pool.push_back({ v, c.degree, c.freq, nullptr });
+    }
+
+    std::sort(pool.begin(), pool.end(), [](ranked const &a, ranked const &b) {
+      return uint64_t{ a.freq } * a.degree > uint64_t{ b.freq } * b.degree;
+    });
+
+    std::vector<ranked> keep;
+    uint64_t used = 0;
+    for (auto const &r : pool) {
+      if (r.freq == 0 || used + r.degree > capacity) continue;
+      keep.push_back(r);
+      used += r.degree;
+    }
+
+    // compact surviving valid lists towards the front, in arena order, so each move
+    // goes downwards and never clobbers a list still to be moved
+    std::vector<ranked *> movers;
+    for (auto &r : keep) {
+      if (r.e && r.e->valid) movers.push_back(&r);
+    }
+    std::sort(movers.begin(), movers.end(), [](ranked const *a, ranked const *b) {
+      return a->e->offset < b->e->offset;
+    });
+
+    std::vector<std::unique_ptr<entry>> next;
+    next.reserve(keep.size());
+    uint64_t cursor = 0;
+    for (auto *r : movers) {
+      if (r->e->offset != cursor) {
+        std::memmove(arena.get() + cursor,
+          arena.get() + r->e->offset,
+          r->degree * sizeof(uint32_t));
+      }
+      next.push_back(std::make_unique<entry>(r->v, r->degree, cursor, r->freq));
+      next.back()->valid = true;
+      cursor += r->degree;
+    }
+    for (auto &r : keep) {
+      if (r.e && r.e->valid) continue;
+      next.push_back(std::make_unique<entry>(r.v, r.degree, cursor, r.freq));
+      cursor += r.degree;
+    }
+
+    std::sort(next.begin(), next.end(), [](auto const &a, auto const &b) {
+      return a->v < b->v;
+    });
+    entries = std::move(next);
+
+    // candidates that were admitted, or whose frequency decayed away, are dropped
+    std::vector<uint32_t> drop;
+    for (auto &[v, c] : candidates) {
+      c.freq /= 2;
+      if (c.freq == 0 || find(v)) drop.push_back(v);
+    }
+    for (auto const v : drop) candidates.erase(v);
+
+    BOOST_LOG_TRIVIAL(debug) << "adjacency cache: " << entries.size() << " lists, "
+                             << (cursor * sizeof(uint32_t) >> 20) << " of "
+                             << (capacity * sizeof(uint32_t) >> 20) << " MiB";
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_ADJACENCY_CACHE_H__
@@ -0,0 +1,167 @@
+#ifndef __PROJ_ADJACENCY_CODEC_H__
+#define __PROJ_ADJACENCY_CODEC_H__
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// Compressed adjacency lists (.cadj). Each sorted list is delta coded and stored with
+// stream-vbyte: per group of four gaps one control byte holds their byte lengths
+// (2 bits each), and the gaps themselves follow as 1-4 byte little-endian values, so
+// a group decodes with one shuffle.
+//
+// A list is a sequence of frames. A frame holds a uint16_t edge count, the control
+// bytes, then the data; deltas restart at every frame. All frames but the last of a
+// list are padded to exactly FRAME_BYTES, so a list larger than an edge window can
+// be fetched in chunks of whole frames without knowing where its edges fall.
+//
+// The matching .cidx file holds the total edge count followed by num_vertices + 1
+// byte offsets into the .cadj file.
+namespace famgraph::codec {
+inline constexpr uint32_t FRAME_BYTES = 4096;
+inline constexpr uint32_t FRAME_HEADER = sizeof(uint16_t);
+
+inline uint32_t value_bytes(uint32_t const x) noexcept
+{
+  if (x < (1u << 8)) return 1;
+  if (x < (1u << 16)) return 2;
+  if (x < (1u << 24)) return 3;
+  return 4;
+}
+
+// Appends the frames of the ascending list edges[0, n) to out.
+inline void encode_list(uint32_t const *const edges,
+  uint32_t const n,
+  std::vector<uint8_t> &out)
+{
+  uint32_t i = 0;
+  while (i < n) {
+    // take whole groups of four while the frame has room
+    uint32_t count = 0;
+    uint32_t size = FRAME_HEADER;
+    while (i + count < n) {
+      uint32_t const g = std::min(4u, n - i - count);
+      uint32_t bytes = 1;// control byte
+      uint32_t prev = count == 0 ? 0 : edges[i + count - 1];
+      for (uint32_t j = 0; j < g; ++j) {
+        bytes += value_bytes(edges[i + count + j] - prev);
+        prev = edges[i + count + j];
+      }
+      if (size + bytes > FRAME_BYTES) break;
+      size += bytes;
+      count += g;
+    }
+
+    size_t const frame = out.size();
+    size_t const n_ctrl = (count + 3) / 4;
+    out.resize(frame + FRAME_HEADER + n_ctrl, 0);
+    auto const header = static_cast<uint16_t>(count);
+    std::memcpy(out.data() + frame, &header, sizeof(header));
+
+    uint32_t prev = 0;
+    for (uint32_t j = 0; j < count; ++j) {
+      uint32_t const gap = edges[i + j] - prev;
+      uint32_t const len = value_bytes(gap);
+      auto &ctrl = out[frame + FRAME_HEADER + j / 4];
+      ctrl = static_cast<uint8_t>(ctrl | (len - 1) << (2 * (j % 4)));
+      for (uint32_t b = 0; b < len; ++b) {
+        out.push_back(static_cast<uint8_t>(gap >> (8 * b)));
+      }
+      prev = edges[i + j];
+    }
+
+    i += count;
+    if (i < n) out.resize(frame + FRAME_BYTES, 0);
+  }
+}
+
+#if defined(__SSSE3__)
+struct group_tables
+{
+  alignas(16) std::array<std::array<uint8_t, 16>, 256> shuffle;
+  std::array<uint8_t, 256> length;
+};
+
+inline group_tables make_group_tables() noexcept
+{
+  group_tables t{};
+  for (uint32_t c = 0; c < 256; ++c) {
+    uint8_t pos = 0;
+    for (uint32_t lane = 0; lane < 4; ++lane) {
+      uint32_t const len = ((c >> (2 * lane)) & 3) + 1;
+      for (uint32_t b = 0; b < 4; ++b) {
+        t.shuffle[c][lane * 4 + b] = b < len ? static_cast<uint8_t>(pos + b) : 0x80;
+      }
+      pos = static_cast<uint8_t>(pos + len);
+    }
+    t.length[c] = pos;
+  }
+  return t;
+}
+
+inline group_tables const tables = make_group_tables();
+#endif
+
+// Decodes the frame at in, which has avail bytes before the end of its list, into
+// out. Returns the number of edges decoded.
+inline uint32_t decode_frame(uint8_t const *const in,
+  [[maybe_unused]] uint64_t const avail,
+  uint32_t *const out) noexcept
+{
+  uint16_t n;
+  std::memcpy(&n, in, sizeof(n));
+  uint8_t const *const ctrl = in + FRAME_HEADER;
+  uint8_t const *data = ctrl + (n + 3) / 4;
+  uint32_t prev = 0;
+  uint32_t i = 0;
+
+#if defined(__SSSE3__)
+  // full groups, while a 16 byte load stays inside the list
+  uint8_t const *const end = in + avail;
+  __m128i carry = _mm_setzero_si128();
+  for (; i + 4 <= n && data + 16 <= end; i += 4) {
+    uint8_t const c = ctrl[i / 4];
+    __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data));
+    v = _mm_shuffle_epi8(
+      v, _mm_load_si128(reinterpret_cast<__m128i const *>(tables.shuffle[c].data())));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), v);
+    carry = _mm_shuffle_epi32(v, 0xff);
+    data += tables.length[c];
+  }
+  prev = static_cast<uint32_t>(_mm_cvtsi128_si32(carry));
+#endif
+
+  for (; i < n; ++i) {
+    uint32_t const len = ((ctrl[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    uint32_t gap = 0;
+    std::memcpy(&gap, data, len);// little-endian
+    data += len;
+    prev += gap;
+    out[i] = prev;
+  }
+  return n;
+}
+
+// Decodes a whole list of degree d stored in bytes [in, in + size) into out.
+inline void decode_list(uint8_t const *const in,
+  uint64_t const size,
+  uint32_t *const out,
+  uint32_t const d) noexcept
+{
+  uint32_t got = 0;
+  for (uint64_t pos = 0; got < d; pos += FRAME_BYTES) {
+    got += decode_frame(in + pos, size - pos, out + got);
+  }
+}
+}// namespace famgraph::codec
+
+#endif// __PROJ_ADJACENCY_CODEC_H__
@@ -5,11 +5,16 @@
 #include "vertex_table.hpp"
 #include "graph_types.hpp"
 #include <client_runtime.hpp>
+#include <algorithm>
 #include <atomic>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "communication_runtime.hpp"
 #include "bitmap.hpp"
+#include "remote_state.hpp"
 
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
@@ -24,6 +29,13 @@
 
 namespace bfs {
 constexpr uint32_t NULLVERT = 0xFFFFFFFF;
+// direction switching thresholds from Beamer et al., "Direction-Optimizing BFS"
+constexpr uint64_t ALPHA = 14;
+constexpr uint64_t BETA = 24;
+// In-edges fetched per unvisited vertex in the first pull pass. Most vertices find a
+// frontier parent early in their list, so the rest is only fetched for those that
+// have not.
+constexpr uint32_t PULL_PREFIX = 16;
 
 struct bfs_vertex
 {
@@ -35,44 +47,190 @@ struct bfs_vertex
     return parent.compare_exchange_strong(
       expect, t_parent, std::memory_order_relaxed, std::memory_order_relaxed);
   }
+
+  bool is_visited() const noexcept
+  {
+    return parent.load(std::memory_order_relaxed) != NULLVERT;
+  }
 };
 
+// The transposed index, if both halves of the in-edge CSR are available. A server's
+// in-index is fetched over RDMA unless --local-index is given.
+inline auto load_in_index(struct client_context &ctx, uint32_t const num_vertices)
+{
+  auto const &vm = *ctx.vm;
+  auto const [server, remote] = ctx.find_region("in-index");
+  if (remote && !vm.count("local-index") && ctx.num_in_edges > 0) {
+    return famgraph::fetch_index(ctx,
+      server,
+      *remote,
+      num_vertices,
+      ctx.num_in_edges,
+      0,
+      vm.count("hp") ? true : false)
+      .index;
+  }
+  if (vm.count("in-indexfile") && ctx.num_in_edges > 0) {
+    return famgraph::load_index(vm["in-indexfile"].as<std::string>(),
+      num_vertices,
+      ctx.num_in_edges,
+      vm.count("hp") ? true : false)
+      .index;
+  }
+  if (vm.count("in-indexfile") || remote || ctx.num_in_edges > 0) {
+    BOOST_LOG_TRIVIAL(warning) << "pull BFS needs the in-index, from --in-indexfile or "
+                                  "a server, and --in-edgefile on the server, running "
+                                  "push only";
+  }
+  return std::unique_ptr<famgraph::compact_index>();
+}
+
+// Null unless --remote-vertex-state leaves vertices without a local entry.
+inline std::unique_ptr<famgraph::remote_vertex_state<uint32_t>>
+  make_remote_parents(struct client_context &ctx, famgraph::Generic_ctx<bfs_vertex> &c)
+{
+  if (c.num_local == c.num_vertices) return nullptr;
+  return std::make_unique<famgraph::remote_vertex_state<uint32_t>>(ctx,
+    c.num_local,
+    c.num_vertices - c.num_local,
+    c.fetch,
+    c.use_cq_events);
+}
 
 template<famgraph::Buffering b> struct bfs_kernel
 {
 public:
   famgraph::Generic_ctx<bfs::bfs_vertex> c;
   uint32_t const start_v;
+  std::unique_ptr<famgraph::compact_index> in_index;
+  famgraph::edge_source const in_edges;
+  // Vertices from c.num_local on keep their parent round on the memory server. Their
+  // visited bits stay here, so claiming a vertex needs no remote atomic; only the
+  // round it was reached in is written back, once per vertex.
+  std::unique_ptr<famgraph::remote_vertex_state<uint32_t>> remote_parents;
+  famgraph::Bitmap remote_visited;
 
   bfs_kernel(struct client_context &ctx)
-    : c(ctx, b), start_v{ (*ctx.vm)["start-vertex"].as<uint32_t>() }
-  {}
+    : c(ctx,
+      b,
+      famgraph::get_num_local(*ctx.vm, ctx.app->num_vertices)),
+      start_v{ (*ctx.vm)["start-vertex"].as<uint32_t>() },
+      in_index{ load_in_index(ctx, c.num_vertices) },
+      in_edges{ in_index.get(),
+        c.num_vertices,
+        ctx.num_in_edges,
+        ctx.peer_in_addr,
+        ctx.peer_in_rkey,
+        nullptr,
+        nullptr,
+        nullptr,
+        ctx.in_edge_server },
+      remote_parents{ make_remote_parents(ctx, c) },
+      remote_visited{ c.num_vertices - c.num_local }
+  {
+    remote_visited.clear();
+    BOOST_LOG_TRIVIAL(info) << "bfs direction optimization: "
+                            << (in_index ? "on" : "off (no in-edges)");
+  }
 
+  // Top-down rounds push the frontier's out-edges. Once those edges exceed 1/ALPHA of
+  // the edges left unexplored, rounds go bottom-up: every unvisited vertex fetches
+  // its in-edges and stops at the first frontier member, which skips most of the
+  // edge array in the dense middle rounds. Rounds go top-down again once the frontier
+  // falls below 1/BETA of the vertices.
   void operator()()
   {
     auto const total_verts = c.num_vertices;
+    auto const num_local = c.num_local;
+    auto const idx = c.p.first.get();
     auto vtable = c.p.second.get();
     auto *frontier = &c.frontierA;
     auto *next_frontier = &c.frontierB;
     tbb::blocked_range<uint32_t> const my_range(0, total_verts);
+    tbb::combinable<uint64_t> next_edges;// out-edges of the next frontier
+
+    auto out_degree = [&](uint32_t const v) {
+      return famgraph::get_num_edges(v, idx, total_verts, c.num_edges);
+    };
+
+    uint32_t round = 0;
+    // true if this call reached v first
+    auto visit = [&](uint32_t const v) noexcept {
+      if (v < num_local) return vtable[v].update_atomic(round);
+      if (!remote_visited.set_bit(v - num_local)) return false;
+      remote_parents->put(v, round);
+      return true;
+    };
+    auto is_visited = [&](uint32_t const v) noexcept {
+      return v < num_local ? vtable[v].is_visited()
+                           : remote_visited.get_bit(v - num_local);
+    };
 
     BOOST_LOG_TRIVIAL(info) << "bfs start vertex: " << start_v;
     frontier->set_bit(start_v);
-    vtable[start_v].update_atomic(0);// 0 distance to self
-    uint32_t round = 0;
+    visit(start_v);// 0 distance to self
+    uint64_t frontier_edges = out_degree(start_v);
+    uint64_t unexplored_edges = c.num_edges - frontier_edges;
+    bool pull = false;
+
     auto bfs_push = [&](uint32_t const, uint32_t *const edges, uint32_t const n) noexcept
     {
       for (uint32_t i = 0; i < n; ++i) {// push out updates //make parallel
         uint32_t w = edges[i];
-        if (vtable[w].update_atomic(round)) {
+        if (visit(w)) {
           next_frontier->set_bit(w);// activate w
+          next_edges.local() += out_degree(w);
         }
       }
     };
+
+    // only the worker fetching v's in-edges writes v, so it can't lose the visit
+    auto bfs_pull = [&](
+      uint32_t const v, uint32_t *const edges, uint32_t const n) noexcept
+    {
+      if (is_visited(v)) return;// found in an earlier pass or chunk
+      for (uint32_t i = 0; i < n; ++i) {
+        if (frontier->get_bit(edges[i])) {
+          visit(v);
+          next_frontier->set_bit(v);
+          next_edges.local() += out_degree(v);
+          return;
+        }
+      }
+    };
+
+    auto unvisited = [&](uint32_t const v) { return !is_visited(v); };
+
     while (!frontier->is_empty()) {
       ++round;
-      famgraph::single_buffer::for_each_active_batch(
-        *frontier, my_range, c, bfs_push);
+      if (in_index) {
+        if (!pull && frontier_edges > unexplored_edges / ALPHA) {
+          pull = true;
+        } else if (pull && frontier->num_set() < total_verts / BETA) {
+          pull = false;
+        }
+      }
+      BOOST_LOG_TRIVIAL(debug) << "bfs round " << round << (pull ? " pull" : " push")
+                               << " frontier " << frontier->num_set();
+
+      if (pull) {
+        famgraph::single_buffer::for_each_matching(
+          my_range, in_edges.slice(0, PULL_PREFIX), unvisited, c, bfs_pull);
+        famgraph::single_buffer::for_each_matching(my_range,
+          in_edges.slice(PULL_PREFIX, std::numeric_limits<uint32_t>::max()),
+          unvisited,
+          c,
+          bfs_pull);
+      } else {
+        famgraph::single_buffer::for_each_active_batch(
+          *frontier, my_range, c, bfs_push);
+      }
+
+      frontier_edges = next_edges.combine(std::plus<uint64_t>{});
+      next_edges.clear();
+      unexplored_edges -= std::min(frontier_edges, unexplored_edges);
+
+      if (remote_parents) remote_parents->flush();
       frontier->clear();
       std::swap(frontier, next_frontier);
     }
@@ -80,7 +238,30 @@ public:
     BOOST_LOG_TRIVIAL(info) << "bfs rounds " << round;
   }
 
-  void print_result() {}
+  void print_result()
+  {
+    if (!remote_parents) return;
+    remote_parents->report();
+    // read the remote rounds back, e.g. to find how deep the remote range lies. One
+    // chunk at a time, so the range never has to fit in client memory.
+    auto constexpr chunk = famgraph::remote_vertex_state<uint32_t>::STAGING_ENTRIES;
+    std::vector<uint32_t> rounds(chunk);
+    uint64_t reached = 0;
+    uint32_t depth = 0;
+    auto const n = c.num_vertices - c.num_local;
+    for (uint32_t begin = 0, end = 0; begin < n; begin = end) {
+      end = begin + std::min(chunk, n - begin);
+      auto i = remote_visited.next_set_bit(begin, end);
+      if (i == end) continue;// nothing reached here, skip the read
+      remote_parents->read(c.num_local + begin, end - begin, rounds.data());
+      for (; i < end; i = remote_visited.next_set_bit(i + 1, end)) {
+        ++reached;
+        depth = std::max(depth, rounds[i - begin]);
+      }
+    }
+    BOOST_LOG_TRIVIAL(info) << "bfs reached " << reached
+                            << " remote vertices, the deepest in round " << depth;
+  }
 };
 
 
@@ -13,6 +13,7 @@
 #include <iostream>//REMOVE
 #include <stdexcept>
 #include <functional>
+#include <algorithm>
 
 #include "graph_kernel.hpp"
 #include "bfs.hpp"
@@ -34,14 +35,44 @@ void validate_params(boost::program_options::variables_map const &vm)
   if (!vm.count("port"))
     throw boost::program_options::validation_error(
       boost::program_options::validation_error::invalid_option_value, "port");
-  if (!vm.count("indexfile"))
+  if (vm["remote-vertex-state"].as<uint32_t>() > 100)
     throw boost::program_options::validation_error(
-      boost::program_options::validation_error::invalid_option_value, "index file");
+      boost::program_options::validation_error::invalid_option_value,
+      "remote-vertex-state");
+}
+
+// --server-addr lists the memory servers in shard order, as host or host:port;
+// entries without a port use --port.
+std::vector<memory_server> parse_servers(std::string const &list,
+  std::string const &default_port)
+{
+  std::vector<memory_server> servers;
+  size_t begin = 0;
+  while (begin <= list.size()) {
+    auto end = list.find(',', begin);
+    if (end == std::string::npos) end = list.size();
+    auto const entry = list.substr(begin, end - begin);
+    auto const colon = entry.find(':');
+    memory_server s;
+    // a second colon means an IPv6 address without a port
+    if (colon != std::string::npos && entry.find(':', colon + 1) == std::string::npos) {
+      s.host = entry.substr(0, colon);
+      s.port = entry.substr(colon + 1);
+    } else {
+      s.host = entry;
+      s.port = default_port;
+    }
+    if (s.host.empty()) throw std::runtime_error("empty entry in --server-addr");
+    servers.push_back(std::move(s));
+    begin = end + 1;
+  }
+  return servers;
 }
 
 void send_message(struct rdma_cm_id *id)
 {
   struct client_context *ctx = static_cast<struct client_context *>(id->context);
+  auto &server = ctx->server_of(id);
 
   struct ibv_send_wr wr, *bad_wr = NULL;
   struct ibv_sge sge;
@@ -54,9 +85,9 @@ void send_message(struct rdma_cm_id *id)
   wr.num_sge = 1;
   wr.send_flags = IBV_SEND_SIGNALED;
 
-  sge.addr = reinterpret_cast<uintptr_t>(ctx->tx_msg);
-  sge.length = sizeof(*ctx->tx_msg);
-  sge.lkey = ctx->tx_msg_mr->lkey;
+  sge.addr = reinterpret_cast<uintptr_t>(server.tx_msg);
+  sge.length = sizeof(*server.tx_msg);
+  sge.lkey = server.tx_msg_mr->lkey;
 
   TEST_NZ(ibv_post_send(id->qp, &wr, &bad_wr));
 }
@@ -64,6 +95,7 @@ void send_message(struct rdma_cm_id *id)
 void post_receive(struct rdma_cm_id *id)
 {
   struct client_context *ctx = static_cast<struct client_context *>(id->context);
+  auto &server = ctx->server_of(id);
   struct ibv_recv_wr wr, *bad_wr = NULL;
   struct ibv_sge sge;
 
@@ -73,9 +105,9 @@ void post_receive(struct rdma_cm_id *id)
   wr.sg_list = &sge;
   wr.num_sge = 1;
 
-  sge.addr = reinterpret_cast<uintptr_t>(ctx->rx_msg);
-  sge.length = sizeof(*ctx->rx_msg);
-  sge.lkey = ctx->rx_msg_mr->lkey;
+  sge.addr = reinterpret_cast<uintptr_t>(server.rx_msg);
+  sge.length = sizeof(*server.rx_msg);
+  sge.lkey = server.rx_msg_mr->lkey;
 
   TEST_NZ(ibv_post_recv(id->qp, &wr, &bad_wr));
 }
@@ -84,24 +116,77 @@ void on_pre_conn(struct rdma_cm_id *id)
 {
   BOOST_LOG_TRIVIAL(debug) << "precon";
   struct client_context *ctx = static_cast<struct client_context *>(id->context);
+  auto &server = ctx->server_of(id);
+  if (!ctx->heap) init_rdma_heap(ctx);// the pd exists from the first connection on
+  if (ctx->heap) {
+    auto *const heap = ctx->heap.get();
+    server.tx_msg = static_cast<struct message *>(heap->allocate(sizeof(*server.tx_msg)));
+    server.rx_msg = static_cast<struct message *>(heap->allocate(sizeof(*server.rx_msg)));
+    if (!server.tx_msg || !server.rx_msg) throw std::runtime_error("RDMA heap is full");
+    server.tx_msg_mr = heap->mr();
+    server.rx_msg_mr = heap->mr();
+    post_receive(id);// prepare to recv MSG_CATALOG
+    return;
+  }
   // tx buffer
-  if (posix_memalign(reinterpret_cast<void **>(&ctx->tx_msg),
+  if (posix_memalign(reinterpret_cast<void **>(&server.tx_msg),
         static_cast<size_t>(sysconf(_SC_PAGESIZE)),
-        sizeof(*ctx->tx_msg))) {
+        sizeof(*server.tx_msg))) {
     throw std::runtime_error("posix memalign failed");
   }
-  TEST_Z(ctx->tx_msg_mr = ibv_reg_mr(rc_get_pd(), ctx->tx_msg, sizeof(*ctx->tx_msg), 0));
+  TEST_Z(server.tx_msg_mr =
+           ibv_reg_mr(rc_get_pd(), server.tx_msg, sizeof(*server.tx_msg), 0));
 
   // rx buffer
-  if (posix_memalign(reinterpret_cast<void **>(&ctx->rx_msg),
+  if (posix_memalign(reinterpret_cast<void **>(&server.rx_msg),
         static_cast<size_t>(sysconf(_SC_PAGESIZE)),
-        sizeof(*ctx->rx_msg))) {
+        sizeof(*server.rx_msg))) {
     throw std::runtime_error("posix memalign failed");
   }
-  TEST_Z(ctx->rx_msg_mr = ibv_reg_mr(
-           rc_get_pd(), ctx->rx_msg, sizeof(*ctx->rx_msg), IBV_ACCESS_LOCAL_WRITE));
+  TEST_Z(server.rx_msg_mr = ibv_reg_mr(rc_get_pd(),
+           server.rx_msg,
+           sizeof(*server.rx_msg),
+           IBV_ACCESS_LOCAL_WRITE));
 
-  post_receive(id);// prepare to recv MSG_MR
+  post_receive(id);// prepare to recv MSG_CATALOG
+}
+
+// The graph this job runs on, out of the catalog server s sent: --graph, or the first
+// one the server lists.
+catalog_entry const &pick_graph(struct message const &msg,
+  boost::program_options::variables_map const &vm,
+  uint32_t const s)
+{
+  auto const &catalog = msg.data.catalog;
+  if (catalog.version != PROTOCOL_VERSION) {
+    throw std::runtime_error("server " + std::to_string(s)
+                             + " speaks another control protocol, rebuild both sides");
+  }
+  auto const count = std::min(catalog.count, CATALOG_MAX);
+  auto name_of = [&](uint32_t const i) {
+    return std::string(catalog.graphs[i].name,
+      strnlen(catalog.graphs[i].name, GRAPH_NAME_MAX));
+  };
+  for (uint32_t i = 0; i < count; ++i) {
+    BOOST_LOG_TRIVIAL(info) << "server " << s << " serves " << name_of(i) << " ("
+                            << catalog.graphs[i].region.graph_edges << " edges)";
+  }
+  if (count == 0) {
+    throw std::runtime_error("server " + std::to_string(s) + " has no graphs");
+  }
+  if (!vm.count("graph")) return catalog.graphs[0];
+
+  auto const name = vm["graph"].as<std::string>();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (name_of(i) == name) return catalog.graphs[i];
+  }
+  throw std::runtime_error("server " + std::to_string(s) + " does not serve " + name);
+}
+
+// every data QP can receive gather replies, whether or not the kernel asks for any
+void on_data_connection(struct rdma_cm_id *id)
+{
+  famgraph::post_gather_receives(id, GATHER_SLOTS);
 }
 
 void on_completion(struct ibv_wc *wc)
@@ -110,72 +195,141 @@ void on_completion(struct ibv_wc *wc)
   struct rdma_cm_id *id = reinterpret_cast<struct rdma_cm_id *>(wc->wr_id);
   struct client_context *ctx = static_cast<struct client_context *>(id->context);
 
+  auto &server = ctx->server_of(id);
   if (wc->opcode & IBV_WC_RECV) {
-    if (ctx->rx_msg->id == MSG_MR) {
-      ctx->peer_addr = ctx->rx_msg->data.mr.addr;
-      ctx->peer_rkey = ctx->rx_msg->data.mr.rkey;
-      uint64_t const num_edges = ctx->rx_msg->data.mr.total_edges;
-      ctx->num_edges = num_edges;
+    if (server.rx_msg->id == MSG_CATALOG) {
+      auto const s = static_cast<uint32_t>(&server - ctx->servers.data());
+      auto const &graph = pick_graph(*server.rx_msg, *ctx->vm, s);
+      auto const mr = graph.region;
+      server.num_vertices = graph.num_vertices;
+      server.max_out_degree = graph.max_out_degree;
+      server.regions.assign(
+        graph.regions, graph.regions + std::min(graph.region_count, REGIONS_MAX));
+      for (auto &r : server.regions) r.name[REGION_NAME_MAX - 1] = 0;
+      ctx->shards.set(s, { mr.first_edge, mr.total_edges, mr.addr, mr.rkey });
+      // the transposed array is not sharded, it is read from whichever server has it
+      if (mr.total_in_edges > 0 && ctx->num_in_edges == 0) {
+        ctx->peer_in_addr = mr.in_addr;
+        ctx->peer_in_rkey = mr.in_rkey;
+        ctx->num_in_edges = mr.total_in_edges;
+        ctx->in_edge_server = s;
+      }
+      bool const first = std::none_of(ctx->servers.begin(),
+        ctx->servers.end(),
+        [](memory_server const &other) { return other.has_mr; });
+      ctx->gather_bytes =
+        first ? mr.gather_bytes : std::min(ctx->gather_bytes, mr.gather_bytes);
+      server.has_mr = true;
       post_receive(id);
-      BOOST_LOG_TRIVIAL(info) << "Received server MR";
-      // init_rdma_heap(ctx);
+      BOOST_LOG_TRIVIAL(info) << "Received MR of server " << s << ": edges ["
+                              << mr.first_edge << ", " << mr.first_edge + mr.total_edges
+                              << ") of " << mr.graph_edges;
+
+      // MR's arrive in any order, but all on this thread
+      for (auto const &other : ctx->servers) {
+        if (!other.has_mr) return;
+      }
+      ctx->shards.validate(mr.graph_edges);
+      ctx->peer_addr = ctx->shards[0].remote_addr;
+      ctx->peer_rkey = ctx->shards[0].rkey;
+
+      // a compressed edge array holds bytes, its edge count comes with its index
+      uint64_t const num_edges =
+        ctx->vm->count("compressed-index")
+          ? famgraph::get_compressed_num_edges(
+            (*ctx->vm)["compressed-index"].as<std::string>())
+          : mr.graph_edges;
+      ctx->num_edges = num_edges;
       ctx->pd = rc_get_pd();// grab a ref to the pd
 
-      uint32_t const num_vertices = famgraph::get_num_verts(ctx->index_file);
+      // the index comes over RDMA from a server that has it, with its size and
+      // degree, unless told to read the local file. A server counts the edges of a
+      // compressed graph in words, so its degrees are not used.
+      auto const [index_server, index] = ctx->find_region("index");
+      bool const remote_index = index && !ctx->vm->count("local-index")
+                                && !ctx->vm->count("compressed-index");
+      if (!remote_index && ctx->index_file.empty()) {
+        throw std::runtime_error("no server serves the index, pass --indexfile");
+      }
+      uint32_t const num_vertices = remote_index
+                                      ? ctx->servers[index_server].num_vertices
+                                      : famgraph::get_num_verts(ctx->index_file);
       BOOST_LOG_TRIVIAL(info) << "|V| " << num_vertices;
       BOOST_LOG_TRIVIAL(info) << "|E| " << num_edges;
+      if (ctx->num_in_edges) BOOST_LOG_TRIVIAL(info) << "|E_in| " << ctx->num_in_edges;
 
       ctx->app = std::make_unique<famgraph::application>(num_vertices, num_edges);
-
-      for (auto &conn_ptr : ctx->cm_ids) {
-        TEST_NZ(rdma_resolve_addr(conn_ptr, NULL, ctx->addr->ai_addr, TIMEOUT_IN_MS));
+      bool const use_HP = ctx->vm->count("hp") ? true : false;
+      if (remote_index) {
+        ctx->index_load = std::async(std::launch::async,
+          [ctx, s = index_server, r = *index, num_vertices, num_edges, use_HP] {
+            ctx->wait_for_connections();
+            return famgraph::fetch_index(*ctx,
+              s,
+              r,
+              num_vertices,
+              num_edges,
+              ctx->servers[s].max_out_degree,
+              use_HP);
+          });
+      } else {
+        ctx->index_load = std::async(std::launch::async,
+          famgraph::load_index,
+          ctx->index_file,
+          num_vertices,
+          num_edges,
+          use_HP);
       }
 
-      while (rc_get_num_connections() < ctx->connections + 1) {}
-      BOOST_LOG_TRIVIAL(info) << "connections: " << rc_get_num_connections();
-
-      ctx->comm_threads.push_back(std::thread(
-        famgraph::comm_runtime_worker2, std::ref(ctx->cm_ids), ctx->app.get()));
+      for (size_t i = 0; i < ctx->cm_ids.size(); ++i) {
+        auto const *const addr = ctx->servers[i % ctx->servers.size()].addr;
+        TEST_NZ(rdma_resolve_addr(ctx->cm_ids[i], NULL, addr->ai_addr, TIMEOUT_IN_MS));
+      }
 
-      if (ctx->vm->count("double-buffer")) {
-        throw std::runtime_error("double buffering deprecated");
+      if (ctx->kernel == "bfs") {
+        ctx->app_thread = std::thread(
+          famgraph::run_kernel<bfs::bfs_kernel<famgraph::Buffering::SINGLE>>,
+          std::ref(*ctx));
+      } else if (ctx->kernel == "pagerank_delta") {
+        ctx->app_thread = std::thread(
+          famgraph::run_kernel<
+            pagerank_delta::pagerank_delta_kernel<famgraph::Buffering::SINGLE>>,
+          std::ref(*ctx));
+      } else if (ctx->kernel == "CC") {
+        ctx->app_thread = std::thread(
+          famgraph::run_kernel<connected_components::connected_components_kernel<
+            famgraph::Buffering::SINGLE>>,
+          std::ref(*ctx));
+      } else if (ctx->kernel == "kcore") {
+        ctx->app_thread = std::thread(
+          famgraph::run_kernel<kcore::kcore_kernel<famgraph::Buffering::SINGLE>>,
+          std::ref(*ctx));
+      } else if (ctx->kernel == "MIS") {
+        ctx->app_thread = std::thread(
+          famgraph::run_kernel<mis::mis_kernel<famgraph::Buffering::SINGLE>>,
+          std::ref(*ctx));
       } else {
-        if (ctx->kernel == "bfs") {
-          ctx->app_thread = std::thread(
-            famgraph::run_kernel<bfs::bfs_kernel<famgraph::Buffering::SINGLE>>,
-            std::ref(*ctx));
-        } else if (ctx->kernel == "pagerank_delta") {
-          ctx->app_thread = std::thread(
-            famgraph::run_kernel<
-              pagerank_delta::pagerank_delta_kernel<famgraph::Buffering::SINGLE>>,
-            std::ref(*ctx));
-        } else if (ctx->kernel == "CC") {
-          ctx->app_thread = std::thread(
-            famgraph::run_kernel<connected_components::connected_components_kernel<
-              famgraph::Buffering::SINGLE>>,
-            std::ref(*ctx));
-        } else if (ctx->kernel == "kcore") {
-          ctx->app_thread = std::thread(
-            famgraph::run_kernel<kcore::kcore_kernel<famgraph::Buffering::SINGLE>>,
-            std::ref(*ctx));
-        } else if (ctx->kernel == "MIS") {
-          ctx->app_thread = std::thread(
-            famgraph::run_kernel<mis::mis_kernel<famgraph::Buffering::SINGLE>>,
-            std::ref(*ctx));
-        } else {
-          BOOST_LOG_TRIVIAL(fatal) << "Unrecognized Kernel";
-          throw std::runtime_error("Unrecognized Kernel");
-        }
+        BOOST_LOG_TRIVIAL(fatal) << "Unrecognized Kernel";
+        throw std::runtime_error("Unrecognized Kernel");
       }
-    } else if (ctx->rx_msg->id == MSG_READY) {// client never receives this
+    } else if (server.rx_msg->id == MSG_STATE) {
+      auto const state = server.rx_msg->data.state;
+      post_receive(id);
+      ctx->state_region.set_value({ state.addr, state.rkey });
+    } else if (server.rx_msg->id == MSG_READY) {// client never receives this
       BOOST_LOG_TRIVIAL(trace) << "received READY";
       post_receive(id);
-    } else if (ctx->rx_msg->id == MSG_DONE) {
+    } else if (server.rx_msg->id == MSG_DONE) {
       BOOST_LOG_TRIVIAL(trace) << "received DONE";
+      server.done = true;
+      for (auto const &other : ctx->servers) {
+        if (!other.done) return;
+      }
       ctx->app_thread.join();
-      for (auto &thread : ctx->comm_threads) { thread.join(); }
       BOOST_LOG_TRIVIAL(info) << "Joined app thread";
-      rc_disconnect(id);// end server connection
+      for (auto const &other : ctx->servers) {
+        rc_disconnect(other.control_id);// end server connection
+      }
       // disconnect comm threads maybe
       famgraph::print_stats_summary(ctx->stats);
       return;
@@ -187,10 +341,20 @@ void on_disconnect(struct rdma_cm_id *id)
 {
   BOOST_LOG_TRIVIAL(debug) << "on disconnect";
   struct client_context *ctx = static_cast<struct client_context *>(id->context);
-  ibv_dereg_mr(ctx->rx_msg_mr);
-  ibv_dereg_mr(ctx->tx_msg_mr);
-  free(ctx->rx_msg);
-  free(ctx->tx_msg);
+  // runs once per server, as its control connection goes down
+  for (auto &server : ctx->servers) {
+    if (server.control_id != id) continue;
+    if (ctx->heap) {
+      ctx->heap->deallocate(server.rx_msg, sizeof(*server.rx_msg));
+      ctx->heap->deallocate(server.tx_msg, sizeof(*server.tx_msg));
+    } else {
+      ibv_dereg_mr(server.rx_msg_mr);
+      ibv_dereg_mr(server.tx_msg_mr);
+      free(server.rx_msg);
+      free(server.tx_msg);
+    }
+    freeaddrinfo(server.addr);
+  }
   BOOST_LOG_TRIVIAL(info) << "Client Disconnect";
 }
 
@@ -234,12 +398,27 @@ void do_numa_map(unsigned long threads)
 }
 }// namespace
 
+void init_rdma_heap(struct client_context *ctx)
+{
+  auto const mb = (*ctx->vm)["rdma-heap-mb"].as<uint32_t>();
+  if (mb == 0) return;
+  // gather replies are written into the edge windows by the servers
+  ctx->heap = std::make_unique<famgraph::rdma_arena>(rc_get_pd(),
+    size_t{ mb } << 20,
+    ctx->vm->count("hp") ? true : false,
+    famgraph::IB_FLAGS | IBV_ACCESS_REMOTE_WRITE);
+  famgraph::rdma_arena::install(ctx->heap.get());
+}
+
 void run_client(boost::program_options::variables_map &vm)
 {
   validate_params(vm);
-  std::string server_ip = vm["server-addr"].as<std::string>();
-  std::string server_port = vm["port"].as<std::string>();
-  std::string ifile = vm["indexfile"].as<std::string>();
+  auto servers =
+    parse_servers(vm["server-addr"].as<std::string>(), vm["port"].as<std::string>());
+  if (servers.size() > 1 && vm.count("compressed-index")) {
+    throw std::runtime_error("compressed adjacency lists cannot be sharded");
+  }
+  std::string ifile = vm.count("indexfile") ? vm["indexfile"].as<std::string>() : "";
   std::string kernel = vm["kernel"].as<std::string>();
   std::string ofile = vm["ofile"].as<std::string>();
   auto const threads = vm["threads"].as<unsigned long>();
@@ -248,29 +427,75 @@ void run_client(boost::program_options::variables_map &vm)
   auto const num_connections = threads == 0 || threads > max_cores ? max_cores : threads;
   bool const print_vtable = vm.count("print-table") ? true : false;
   auto const numa_bind = vm.count("no-numa-bind") ? false : true;
-
-  if (numa_bind) do_numa_map(num_connections);
+  bool const numa_aware = vm.count("numa-aware") ? true : false;
+
+  // --numa-aware places memory itself, so it replaces the interleaved binding
+  std::unique_ptr<famgraph::numa_placement> placement;
+  if (numa_aware) {
+    placement = std::make_unique<famgraph::numa_placement>();
+    // QP's, CQ's and message buffers are allocated by this thread: keep them by the HCA
+    numa_run_on_node(placement->hca());
+    numa_set_preferred(placement->hca());
+  } else if (numa_bind) {
+    do_numa_map(num_connections);
+  }
 
   BOOST_LOG_TRIVIAL(info) << "Starting client";
-  BOOST_LOG_TRIVIAL(info) << "Server IPoIB address: " << server_ip
-                          << " port: " << server_port;
+  for (size_t i = 0; i < servers.size(); ++i) {
+    BOOST_LOG_TRIVIAL(info) << "Server " << i << " IPoIB address: " << servers[i].host
+                            << " port: " << servers[i].port;
+  }
   BOOST_LOG_TRIVIAL(info) << "Index File: " << ifile;
 
+  bool const remote_state = vm["remote-vertex-state"].as<uint32_t>() > 0;
+  auto const qps_per_worker = vm["qps-per-worker"].as<unsigned long>();
+  if (qps_per_worker == 0) throw std::runtime_error("qps-per-worker must be > 0");
+  BOOST_LOG_TRIVIAL(info) << "QPs per worker and server: " << qps_per_worker;
   struct client_context ctx
   {
-    ifile, num_connections, kernel, ofile, print_vtable, &vm
+    ifile, std::move(servers), num_connections, qps_per_worker, remote_state, kernel,
+      ofile, print_vtable, &vm
   };
+  if (placement) {
+    ctx.numa = std::move(placement);
+    ctx.pinning = std::make_unique<famgraph::worker_pinning>(*ctx.numa);
+    ctx.stats.num_nodes = std::min(ctx.numa->node_count(), famgraph::MAX_NUMA_NODES);
+  }
   rc_init(on_pre_conn,
     NULL,// on connect
     on_completion,
     on_disconnect);// on disconnect
+  rc_set_data_connect_cb(on_data_connection);
+
+  rc_client_loop(&ctx);
+}
 
-  rc_client_loop(server_ip.c_str(), server_port.c_str(), &ctx);
+void client_context::wait_for_connections() const
+{
+  auto const t0 = std::chrono::steady_clock::now();
+  while (rc_get_num_connections() < connections + servers.size()) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double> const secs = std::chrono::steady_clock::now() - t0;
+  BOOST_LOG_TRIVIAL(info) << "connections: " << rc_get_num_connections() << " (waited "
+                          << secs.count() << " s)";
 }
 
 void client_context::finish_application()
 {
   app->should_stop = true;
-  tx_msg->id = MSG_READY;// well get a MSG_DONE BACK
-  send_message(base_id);
+  for (auto &server : servers) {
+    server.tx_msg->id = MSG_READY;// well get a MSG_DONE BACK
+    send_message(server.control_id);
+  }
+}
+
+std::pair<uint64_t, uint32_t> client_context::request_state_region(uint64_t const bytes)
+{
+  auto region = state_region.get_future();
+  auto &server = servers[0];
+  server.tx_msg->id = MSG_STATE;
+  server.tx_msg->data.state.bytes = bytes;
+  send_message(server.control_id);
+  return region.get();
 }
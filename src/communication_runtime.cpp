@@ -1,14 +1,7 @@
 #include <infiniband/verbs.h>
+#include <arpa/inet.h>//for ntohl
 
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wold-style-cast"
-#pragma GCC diagnostic ignored "-Wsign-conversion"
-
-#include <tbb/concurrent_queue.h>
-
-#pragma GCC diagnostic pop
-
 #include "communication_runtime.hpp"
 #include "graph_types.hpp"
 
@@ -19,29 +12,68 @@
 #include <client_runtime.hpp>
 #include <connection_utils.hpp>
 
-void famgraph::comm_runtime_worker2(std::vector<struct rdma_cm_id *> &cm_ids,
-  famgraph::application *app) noexcept
+// Gather replies arrive as RDMA_WRITE_WITH_IMM, each consuming one of these
+// (empty) receives.
+void famgraph::post_gather_receives(struct rdma_cm_id *id, uint32_t const n) noexcept
+{
+  for (uint32_t i = 0; i < n; ++i) {
+    struct ibv_recv_wr wr, *bad_wr = NULL;
+    memset(&wr, 0, sizeof(wr));
+    TEST_NZ(ibv_post_recv(id->qp, &wr, &bad_wr));
+  }
+}
+
+// Reaps whatever has finished on id's CQ and publishes the wr_id of each tagged chain,
+// or the seq of each gather reply, into ring. Called inline by the worker that owns
+// the QP, so no other core touches the CQ.
+int famgraph::poll_completions(struct rdma_cm_id *id,
+  famgraph::completion_ring &ring) noexcept
 {
-  struct ibv_cq *cq;
   struct ibv_wc wc[famgraph::WC_POLL_WINDOW];
-  constexpr unsigned long batch = 1 << 12;
-  unsigned long n_comp = 0;
-
-  while (!app->should_stop) {
-    for (unsigned long iter = 0; iter < batch; ++iter) {
-      for (auto id : cm_ids) {
-        cq = id->send_cq;
-        if (int n = ibv_poll_cq(cq, famgraph::WC_POLL_WINDOW, wc)) {
-          for (int i = 0; i < n; ++i) {
-            n_comp += static_cast<unsigned long>(n);
-            if (wc[i].status != IBV_WC_SUCCESS) {
-              BOOST_LOG_TRIVIAL(fatal) << "poll_cq: status is not IBV_WC_SUCCESS";
-              return;
-            }
-          }
-        }
-      }
+  int const n = ibv_poll_cq(id->send_cq, famgraph::WC_POLL_WINDOW, wc);
+  if (n < 0) rc_die("ibv_poll_cq failed");
+  for (int i = 0; i < n; ++i) {
+    if (wc[i].status != IBV_WC_SUCCESS) {
+      BOOST_LOG_TRIVIAL(fatal) << "poll_cq: status is not IBV_WC_SUCCESS: "
+                               << ibv_wc_status_str(wc[i].status);
+      rc_die("data QP completion error");
+    }
+    if (wc[i].opcode == IBV_WC_RECV_RDMA_WITH_IMM) {
+      ring.complete(ring.expand(ntohl(wc[i].imm_data)));
+      post_gather_receives(id, 1);
+    } else if (wc[i].wr_id) {
+      ring.complete(wc[i].wr_id);
     }
   }
-  BOOST_LOG_TRIVIAL(info) << "Comm thread exiting. n_comp = " << n_comp;
+  return n;
+}
+
+// Busy polls id's CQ until chain seq has completed. With use_events set, a worker that
+// has polled an empty CQ for a while arms it and sleeps on its completion channel
+// instead, which frees the core during long idle phases.
+void famgraph::wait_for_completion(struct rdma_cm_id *id,
+  famgraph::completion_ring &ring,
+  uint64_t const seq,
+  bool const use_events) noexcept
+{
+  constexpr unsigned long spins_before_block = 1 << 14;
+  unsigned long spins = 0;
+
+  while (!ring.is_done(seq)) {
+    if (poll_completions(id, ring) > 0) {
+      spins = 0;
+      continue;
+    }
+    if (!use_events || ++spins < spins_before_block) continue;
+
+    // arm first, then poll once more to catch a completion that raced the arm
+    TEST_NZ(ibv_req_notify_cq(id->send_cq, 0));
+    if (poll_completions(id, ring) > 0) continue;
+
+    struct ibv_cq *ev_cq;
+    void *ev_ctx;
+    TEST_NZ(ibv_get_cq_event(id->send_cq_channel, &ev_cq, &ev_ctx));
+    ibv_ack_cq_events(ev_cq, 1);
+    spins = 0;
+  }
 }
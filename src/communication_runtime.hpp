@@ -3,20 +3,25 @@
 
 #include <rdma/rdma_cma.h>
 #include "graph_types.hpp"
+#include "completion_ring.hpp"
 #include <vector>
-#include <build_options.hpp>
 
 namespace famgraph {
 
-inline constexpr uint32_t WR_WINDOW_SIZE = famgraph::build_options::opt_wr_window;
 inline constexpr uint32_t NULL_VERT = 0xFFFFFFFF;
 inline constexpr uint32_t cacheline_size = 64;// in bytes
 inline constexpr uint32_t WC_POLL_WINDOW = 100;
 inline constexpr uint32_t SINGLE_BUFFER = 1;
 inline constexpr uint32_t DOUBLE_BUFFER = 2;
 
-void comm_runtime_worker2(std::vector<struct rdma_cm_id *> &cm_ids,
-  application *app) noexcept;
+int poll_completions(struct rdma_cm_id *id, completion_ring &ring) noexcept;
+
+void post_gather_receives(struct rdma_cm_id *id, uint32_t const n) noexcept;
+
+void wait_for_completion(struct rdma_cm_id *id,
+  completion_ring &ring,
+  uint64_t const seq,
+  bool const use_events) noexcept;
 }// namespace famgraph
 
 #endif// __PROJ_COMMUNICATION_RUNTIME_H__
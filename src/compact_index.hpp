@@ -0,0 +1,110 @@
+#ifndef __PROJ_COMPACT_INDEX_H__
+#define __PROJ_COMPACT_INDEX_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mmap_util.hpp"
+
+namespace famgraph {
+// The edge offsets of a graph's vertices in a little over 3 bytes per vertex instead
+// of 8. Vertices come in blocks of BLOCK: a block keeps the 64-bit offset of its first
+// vertex and every vertex its 16-bit distance from it. A block whose lists span 64K
+// edges or more keeps full offsets on the side instead. Degrees below DEGREE_ESCAPE
+// are kept in a byte per vertex, so most degree lookups read one byte; larger ones are
+// taken from the offsets.
+class compact_index
+{
+public:
+  static constexpr uint32_t BLOCK_SHIFT = 6;
+  static constexpr uint32_t BLOCK = 1 << BLOCK_SHIFT;
+  static constexpr uint8_t DEGREE_ESCAPE = 255;
+
+private:
+  static constexpr uint64_t WIDE = uint64_t{ 1 } << 63;// the rest indexes wide
+
+  uint32_t const n;
+  uint64_t const m;
+  std::unique_ptr<uint64_t, mmap_deleter> const base;// per block
+  std::unique_ptr<uint16_t, mmap_deleter> const rel;// per vertex
+  std::unique_ptr<uint8_t, mmap_deleter> const deg;// per vertex
+  std::vector<uint64_t> wide;// full offsets of the blocks flagged WIDE
+  std::mutex wide_lock;
+
+public:
+  compact_index(uint32_t const num_vertices, uint64_t const num_edges, bool const use_HP)
+    : n{ num_vertices }, m{ num_edges },
+      base{ mmap_unique<uint64_t>(num_blocks(), use_HP) },
+      rel{ mmap_unique<uint16_t>(n, use_HP) }, deg{ mmap_unique<uint8_t>(n, use_HP) }
+  {}
+
+  compact_index &operator=(const compact_index &) = delete;
+  compact_index(const compact_index &) = delete;
+
+  uint32_t num_vertices() const noexcept { return n; }
+
+  uint64_t num_blocks() const noexcept { return (uint64_t{ n } + BLOCK - 1) / BLOCK; }
+
+  // Client memory held, in bytes.
+  uint64_t bytes() const noexcept
+  {
+    return num_blocks() * sizeof(uint64_t) + uint64_t{ n } * 3
+           + wide.size() * sizeof(uint64_t);
+  }
+
+  // The position of v's first edge in the edge array.
+  uint64_t offset(uint32_t const v) const noexcept
+  {
+    auto const b = base.get()[v >> BLOCK_SHIFT];
+    if (b & WIDE) return wide[(b & ~WIDE) + (v & (BLOCK - 1))];
+    return b + rel.get()[v];
+  }
+
+  uint32_t degree(uint32_t const v) const noexcept
+  {
+    auto const d = deg.get()[v];
+    if (d != DEGREE_ESCAPE) return d;
+    auto const end = v + 1 == n ? m : offset(v + 1);
+    return static_cast<uint32_t>(end - offset(v));
+  }
+
+  // Stores the offsets of vertices [begin, end): offsets[i] is vertex begin + i's, and
+  // next is where vertex end - 1's list ends. begin must start a block. Disjoint
+  // ranges may be filled in parallel. Returns the largest degree in the range.
+  uint32_t fill(uint32_t const begin,
+    uint32_t const end,
+    uint64_t const *const offsets,
+    uint64_t const next)
+  {
+    uint32_t max_degree = 0;
+    for (uint64_t first = begin; first < end; first += BLOCK) {
+      auto const len = static_cast<uint32_t>(std::min(uint64_t{ BLOCK }, end - first));
+      auto const *const o = offsets + (first - begin);
+      auto &b = base.get()[first >> BLOCK_SHIFT];
+      if (o[len - 1] - o[0] > std::numeric_limits<uint16_t>::max()) {
+        std::lock_guard<std::mutex> const guard{ wide_lock };
+        b = WIDE | wide.size();
+        wide.insert(wide.end(), o, o + len);
+      } else {
+        b = o[0];
+        for (uint32_t i = 0; i < len; ++i) {
+          rel.get()[first + i] = static_cast<uint16_t>(o[i] - o[0]);
+        }
+      }
+      for (uint32_t i = 0; i < len; ++i) {
+        auto const d = (first + i + 1 < end ? o[i + 1] : next) - o[i];
+        deg.get()[first + i] =
+          static_cast<uint8_t>(std::min(d, uint64_t{ DEGREE_ESCAPE }));
+        max_degree = std::max(max_degree, static_cast<uint32_t>(d));
+      }
+    }
+    return max_degree;
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_COMPACT_INDEX_H__
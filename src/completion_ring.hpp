@@ -0,0 +1,44 @@
+#ifndef __PROJ_COMPLETION_RING_H__
+#define __PROJ_COMPLETION_RING_H__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "stats.hpp"// for MAX_PIPELINE_DEPTH
+
+namespace famgraph {
+// Per-worker record of finished WR chains. A worker tags the last (signaled) WR of
+// each chain with a fresh sequence number as its wr_id; whoever polls the worker's CQ
+// publishes that number into the slot it hashes to. A worker never has more than
+// MAX_PIPELINE_DEPTH chains in flight, so a slot is not reused before it is consumed.
+struct alignas(64) completion_ring
+{
+  std::array<std::atomic<uint64_t>, MAX_PIPELINE_DEPTH> done{};
+  uint64_t last_seq{ 0 };// only touched by the owning worker
+
+  // wr_id 0 is reserved for signaled WR's nobody waits on
+  uint64_t next_seq() noexcept { return ++last_seq; }
+
+  void complete(uint64_t const seq) noexcept
+  {
+    done[seq % MAX_PIPELINE_DEPTH].store(seq, std::memory_order_release);
+  }
+
+  // Recovers the sequence number of an in-flight chain from its low 32 bits, as
+  // carried in the immediate data of a gather reply. Only the owning worker calls it.
+  uint64_t expand(uint32_t const low) const noexcept
+  {
+    uint64_t seq = (last_seq & ~uint64_t{ 0xffffffff }) | low;
+    if (seq > last_seq) seq -= uint64_t{ 1 } << 32;
+    return seq;
+  }
+
+  bool is_done(uint64_t const seq) const noexcept
+  {
+    return done[seq % MAX_PIPELINE_DEPTH].load(std::memory_order_acquire) == seq;
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_COMPLETION_RING_H__
@@ -1,8 +1,14 @@
 #include <connection_utils.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <boost/log/trivial.hpp>
 
 #include <client_runtime.hpp>
+#include "messages.hpp"
 
 struct context
 {
@@ -10,7 +16,8 @@ struct context
   struct ibv_pd *pd;
   struct ibv_cq *cq;
   struct ibv_comp_channel *comp_channel;
-  volatile unsigned long connections;
+  std::atomic<unsigned long> connections;
+  rc_link_caps caps;
 
   pthread_t cq_poller_thread;
 };
@@ -20,13 +27,63 @@ static pre_conn_cb_fn s_on_pre_conn_cb = NULL;
 static connect_cb_fn s_on_connect_cb = NULL;
 static completion_cb_fn s_on_completion_cb = NULL;
 static disconnect_cb_fn s_on_disconnect_cb = NULL;
+static connect_cb_fn s_on_data_connect_cb = NULL;
+// control connections, one per memory server; every other connection is a data QP
+static std::vector<struct rdma_cm_id *> s_control_ids;
+// the client marks its control connections with this private data byte, so a server
+// that outlives its clients can tell them from data QPs
+static uint8_t const CONTROL_CONNECTION = 1;
+static struct rdma_event_channel *s_listen_ec = NULL;
+static struct rdma_cm_id *s_listener = NULL;
+// the client sets its data QPs up on this many event channels, one thread each
+static size_t const DATA_CM_CHANNELS = 8;
+// completions the control CQ holds, if the device allows that many
+static int const CONTROL_CQE = 1024;
 
 static void build_context(struct ibv_context *verbs);
 static void build_qp_attr(struct ibv_qp_init_attr *qp_attr, bool is_qp0);
+static void build_data_cq(struct rdma_cm_id *id, struct ibv_qp_init_attr *qp_attr);
 static void event_loop(struct rdma_event_channel *ec, int exit_on_disconnect);
 static void *poll_cq(void *);
 
-unsigned long rc_get_num_connections() { return s_ctx->connections; }
+unsigned long rc_get_num_connections() { return s_ctx ? s_ctx->connections.load() : 0; }
+
+rc_link_caps rc_get_link_caps() { return s_ctx ? s_ctx->caps : rc_link_caps{}; }
+
+// Sizes queues and read depths from what the device reports.
+static rc_link_caps query_link_caps(struct ibv_context *verbs)
+{
+  struct ibv_device_attr dev;
+  struct ibv_port_attr port;
+  TEST_NZ(ibv_query_device(verbs, &dev));
+  TEST_NZ(ibv_query_port(verbs, 1, &port));
+
+  rc_link_caps caps{};
+  // the CM carries read depths in a byte
+  auto const depth = [](int const d) {
+    return static_cast<uint8_t>(std::clamp(d, 1, 255));
+  };
+  caps.initiator_depth = depth(dev.max_qp_init_rd_atom);
+  caps.responder_resources = depth(dev.max_qp_rd_atom);
+  // a data QP's send and receive queues share its CQ
+  caps.max_send_wr = static_cast<uint32_t>(
+    std::max(std::min(dev.max_qp_wr, dev.max_cqe - static_cast<int>(GATHER_SLOTS)), 1));
+  caps.control_cqe = static_cast<uint32_t>(std::min(dev.max_cqe, CONTROL_CQE));
+  caps.active_mtu = 128u << port.active_mtu;// IBV_MTU_256 is 1
+
+  BOOST_LOG_TRIVIAL(info) << ibv_get_device_name(verbs->device)
+                          << ": outstanding READs per QP "
+                          << unsigned{ caps.initiator_depth } << " as initiator, "
+                          << unsigned{ caps.responder_resources } << " as responder; "
+                          << "send queue " << caps.max_send_wr << " WR's; control CQ "
+                          << caps.control_cqe << "; MTU " << caps.active_mtu;
+  return caps;
+}
+
+static bool is_control(struct rdma_cm_id *id)
+{
+  return std::find(s_control_ids.begin(), s_control_ids.end(), id) != s_control_ids.end();
+}
 
 void build_connection(struct rdma_cm_id *id, bool is_qp0)
 {
@@ -34,6 +91,7 @@ void build_connection(struct rdma_cm_id *id, bool is_qp0)
 
   build_context(id->verbs);// guaranteed to only go thru on qp0
   build_qp_attr(&qp_attr, is_qp0);// do special handling on qp > 0
+  if (!is_qp0) build_data_cq(id, &qp_attr);
 
   TEST_NZ(rdma_create_qp(id, s_ctx->pd, &qp_attr));
 }
@@ -46,51 +104,82 @@ void build_context(struct ibv_context *verbs)
     return;
   }
 
-  s_ctx = static_cast<struct context *>(malloc(sizeof(struct context)));
+  s_ctx = new context;
 
   s_ctx->ctx = verbs;
   s_ctx->connections = 0;
+  s_ctx->caps = query_link_caps(verbs);
 
   TEST_Z(s_ctx->pd = ibv_alloc_pd(s_ctx->ctx));
   TEST_Z(s_ctx->comp_channel = ibv_create_comp_channel(s_ctx->ctx));
-  TEST_Z(s_ctx->cq = ibv_create_cq(
-           s_ctx->ctx, 10, NULL, s_ctx->comp_channel, 0)); /* cqe=10 is arbitrary */
+  TEST_Z(s_ctx->cq = ibv_create_cq(s_ctx->ctx,
+           static_cast<int>(s_ctx->caps.control_cqe),
+           NULL,
+           s_ctx->comp_channel,
+           0));
   TEST_NZ(ibv_req_notify_cq(s_ctx->cq, 0));// can flip to solicited only
 
   TEST_NZ(pthread_create(&s_ctx->cq_poller_thread, NULL, poll_cq, s_ctx));
 }
 
+// Offers the device's full read depth; the passive side accepts the smaller of what
+// each end can do, see accept_params.
 void build_params(struct rdma_conn_param *params)
 {
   memset(params, 0, sizeof(*params));
 
-  params->initiator_depth = params->responder_resources = 1;
+  params->initiator_depth = s_ctx->caps.initiator_depth;
+  params->responder_resources = s_ctx->caps.responder_resources;
   params->rnr_retry_count = 7; /* infinite retry */
 }
 
+// The connection parameters that answer a peer asking for conn: we serve at most
+// as many reads as it will issue, and issue at most as many as it will serve.
+static struct rdma_conn_param accept_params(struct rdma_conn_param const &conn)
+{
+  struct rdma_conn_param params;
+  build_params(&params);
+  params.responder_resources =
+    std::min(params.responder_resources, conn.initiator_depth);
+  params.initiator_depth = std::min(params.initiator_depth, conn.responder_resources);
+  return params;
+}
+
 void build_qp_attr(struct ibv_qp_init_attr *qp_attr, bool is_qp0)// take index as param
 {
   memset(qp_attr, 0, sizeof(*qp_attr));
 
   if (is_qp0) {
-    qp_attr->send_cq = s_ctx->cq;// index into cq array /or just make a new qp
+    qp_attr->send_cq = s_ctx->cq;// control plane, polled by poll_cq
     qp_attr->recv_cq = s_ctx->cq;// reuse from above
-  } else {
-    // struct ibv_cq * cq;
-    // TEST_Z(cq = ibv_create_cq(s_ctx->ctx, 10, NULL, NULL, 0)); /* cqe=10 is arbitrary
-    // */ qp_attr->send_cq = cq; //index into cq array /or just make a new qp
-    // qp_attr->recv_cq = cq; //reuse from above
-  }
+  }// data qp's get their own cq in build_data_cq
 
   qp_attr->qp_type = IBV_QPT_RC;
 
-  qp_attr->cap.max_send_wr = 16000;// max from ibv_devinfo: max_qp_wr: 16351
-  qp_attr->cap.max_recv_wr = 10;
+  qp_attr->cap.max_send_wr = s_ctx->caps.max_send_wr;
+  qp_attr->cap.max_recv_wr = is_qp0 ? 10 : GATHER_SLOTS;
   qp_attr->cap.max_send_sge = 1;
   qp_attr->cap.max_recv_sge = 1;
   qp_attr->sq_sig_all = 0;// shouldn't need this explicitly
 }
 
+// Every data QP gets a private CQ, shared by its send and recv queues, that only the
+// worker owning the QP polls. The CQ and its completion channel are handed to the
+// cm_id so rdma_destroy_qp releases them along with the QP.
+void build_data_cq(struct rdma_cm_id *id, struct ibv_qp_init_attr *qp_attr)
+{
+  struct ibv_comp_channel *channel;
+  struct ibv_cq *cq;
+  auto const cqe = static_cast<int>(qp_attr->cap.max_send_wr + qp_attr->cap.max_recv_wr);
+
+  TEST_Z(channel = ibv_create_comp_channel(id->verbs));
+  TEST_Z(cq = ibv_create_cq(id->verbs, cqe, id, channel, 0));
+
+  id->send_cq_channel = id->recv_cq_channel = channel;
+  id->send_cq = id->recv_cq = cq;
+  qp_attr->send_cq = qp_attr->recv_cq = cq;
+}
+
 namespace {
 std::string cm_event_to_string(rdma_cm_event_type e)
 {
@@ -151,55 +240,128 @@ std::string cm_event_to_string(rdma_cm_event_type e)
 void event_loop(struct rdma_event_channel *ec, int exit_on_disconnect)
 {
   struct rdma_cm_event *event = NULL;
-  struct rdma_conn_param cm_params;
 
-  build_params(&cm_params);
-
-  // only run custom handlers on connection 0
-  bool latch0 = false;
-  // bool latch1 = false;
-  bool latch2 = false;
-  bool latch3 = false;
-  bool latch4 = false;
+  // only run custom handlers on control connections: the client registers one per
+  // server up front, the server takes those whose private data marks them
+  //
+  // The server runs one job at a time. These are the ids it accepted for the current
+  // one, its control id first; empty while no job runs. Ids of earlier jobs may
+  // still disconnect after the next job has started, and are only torn down.
+  std::vector<struct rdma_cm_id *> job;
 
   while (rdma_get_cm_event(ec, &event) == 0) {
     struct rdma_cm_event event_copy;
 
     memcpy(&event_copy, event, sizeof(*event));
+    // private data lives in the event, read it before the ack frees it
+    auto const *const pdata =
+      static_cast<uint8_t const *>(event->param.conn.private_data);
+    bool const marked_control = event->event == RDMA_CM_EVENT_CONNECT_REQUEST
+                                && event->param.conn.private_data_len > 0
+                                && pdata[0] == CONTROL_CONNECTION;
     rdma_ack_cm_event(event);
 
     if (event_copy.event == RDMA_CM_EVENT_ADDR_RESOLVED) {// Runs on client
-      build_connection(event_copy.id, !latch0);
+      bool const control = is_control(event_copy.id);
+      build_connection(event_copy.id, control);
       BOOST_LOG_TRIVIAL(debug) << "CLIENT1";
-      if (s_on_pre_conn_cb && !latch0) s_on_pre_conn_cb(event_copy.id);
+      if (s_on_pre_conn_cb && control) s_on_pre_conn_cb(event_copy.id);
 
       TEST_NZ(rdma_resolve_route(event_copy.id, TIMEOUT_IN_MS));
-
-      latch0 = true;
     } else if (event_copy.event == RDMA_CM_EVENT_ROUTE_RESOLVED) {// Runs on client
-      TEST_NZ(rdma_connect(event_copy.id, &cm_params));
+      struct rdma_conn_param params;
+      build_params(&params);
+      if (is_control(event_copy.id)) {
+        params.private_data = &CONTROL_CONNECTION;
+        params.private_data_len = sizeof(CONTROL_CONNECTION);
+      }
+      TEST_NZ(rdma_connect(event_copy.id, &params));
       BOOST_LOG_TRIVIAL(debug) << "CLIENT2";
     } else if (event_copy.event == RDMA_CM_EVENT_CONNECT_REQUEST) {// Runs on server
-      build_connection(event_copy.id, !latch2);
+      // a control request starts a job, a data request joins the running one
+      if (marked_control != job.empty()) {
+        BOOST_LOG_TRIVIAL(warning)
+          << (marked_control ? "a job is running, rejecting another client"
+                             : "rejecting a data connection outside of a job");
+        rdma_reject(event_copy.id, NULL, 0);
+        rdma_destroy_id(event_copy.id);
+        continue;
+      }
+      if (marked_control) s_control_ids.push_back(event_copy.id);
+      job.push_back(event_copy.id);
+      build_connection(event_copy.id, marked_control);
       BOOST_LOG_TRIVIAL(debug) << "SERVER1";
-      if (s_on_pre_conn_cb && !latch2) s_on_pre_conn_cb(event_copy.id);
+      if (s_on_pre_conn_cb && marked_control) s_on_pre_conn_cb(event_copy.id);
 
-      TEST_NZ(rdma_accept(event_copy.id, &cm_params));
-      latch2 = true;
+      auto params = accept_params(event_copy.param.conn);
+      BOOST_LOG_TRIVIAL(debug)
+        << "accepting with " << unsigned{ params.responder_resources }
+        << " READs served, " << unsigned{ params.initiator_depth } << " issued";
+      TEST_NZ(rdma_accept(event_copy.id, &params));
     } else if (event_copy.event == RDMA_CM_EVENT_ESTABLISHED) {// Runs on both
-      if (s_on_connect_cb && !latch3) s_on_connect_cb(event_copy.id);
+      bool const control = is_control(event_copy.id);
+      if (s_on_connect_cb && control) s_on_connect_cb(event_copy.id);
+      if (s_on_data_connect_cb && !control) s_on_data_connect_cb(event_copy.id);
       BOOST_LOG_TRIVIAL(debug) << "BOTH1";
-      latch3 = true;
       s_ctx->connections++;
     } else if (event_copy.event == RDMA_CM_EVENT_DISCONNECTED) {// Runs on both
-      rdma_destroy_qp(event_copy.id);
       BOOST_LOG_TRIVIAL(debug) << "BOTH2";
-      if (s_on_disconnect_cb && !latch4) s_on_disconnect_cb(event_copy.id);
+      // the first disconnect of one of the job's ids ends the job; its handler runs
+      // while every QP of the job still exists, e.g. to stop threads polling them. The
+      // client runs it for every server it leaves.
+      bool const ends_job =
+        exit_on_disconnect
+        || std::find(job.begin(), job.end(), event_copy.id) != job.end();
+      if (ends_job) {
+        if (s_on_disconnect_cb) s_on_disconnect_cb(event_copy.id);
+        job.clear();
+      }
+      rdma_destroy_qp(event_copy.id);
 
+      s_control_ids.erase(
+        std::remove(s_control_ids.begin(), s_control_ids.end(), event_copy.id),
+        s_control_ids.end());
       rdma_destroy_id(event_copy.id);
 
-      if (exit_on_disconnect) break;
-      latch4 = true;
+      // the client leaves once every server's control connection is down
+      if (exit_on_disconnect && s_control_ids.empty()) break;
+    } else {
+      BOOST_LOG_TRIVIAL(fatal) << cm_event_to_string(event_copy.event);
+      throw std::runtime_error("RDMA event not handled");
+    }
+  }
+}
+
+// Connects the n data QPs whose ids were created on ec and returns once all of them
+// are established. The client runs one of these per data channel, so creating the
+// QPs and CQs of many workers, and their handshakes, proceed in parallel.
+static void data_event_loop(struct rdma_event_channel *ec, size_t const n)
+{
+  struct rdma_cm_event *event = NULL;
+
+  for (size_t established = 0; established < n;) {
+    TEST_NZ(rdma_get_cm_event(ec, &event));
+    struct rdma_cm_event event_copy;
+    memcpy(&event_copy, event, sizeof(*event));
+    rdma_ack_cm_event(event);
+
+    if (event_copy.event == RDMA_CM_EVENT_ADDR_RESOLVED) {
+      build_connection(event_copy.id, false);
+      TEST_NZ(rdma_resolve_route(event_copy.id, TIMEOUT_IN_MS));
+    } else if (event_copy.event == RDMA_CM_EVENT_ROUTE_RESOLVED) {
+      struct rdma_conn_param params;
+      build_params(&params);
+      TEST_NZ(rdma_connect(event_copy.id, &params));
+    } else if (event_copy.event == RDMA_CM_EVENT_ESTABLISHED) {
+      if (established == 0) {
+        // the active side learns what the server accepted
+        BOOST_LOG_TRIVIAL(info) << "data QPs: up to "
+                                << unsigned{ event_copy.param.conn.responder_resources }
+                                << " outstanding READs each";
+      }
+      if (s_on_data_connect_cb) s_on_data_connect_cb(event_copy.id);
+      s_ctx->connections++;
+      ++established;
     } else {
       BOOST_LOG_TRIVIAL(fatal) << cm_event_to_string(event_copy.event);
       throw std::runtime_error("RDMA event not handled");
@@ -242,54 +404,86 @@ void rc_init(pre_conn_cb_fn pc,
   s_on_disconnect_cb = disc;
 }
 
-void rc_client_loop(const char *host, const char *port, struct client_context *context)
+void rc_set_data_connect_cb(connect_cb_fn data_conn) { s_on_data_connect_cb = data_conn; }
+
+// Opens a control connection to every server in context->servers. The data QPs in
+// context->cm_ids are created here but only resolved once the servers have sent
+// their MR's; they are spread over DATA_CM_CHANNELS event channels, each served by a
+// thread of its own.
+void rc_client_loop(struct client_context *context)
 {
-  struct addrinfo *addr;
-  struct rdma_cm_id *conn = NULL;
   struct rdma_event_channel *ec = NULL;
 
-  TEST_NZ(getaddrinfo(host, port, NULL, &addr));
-
   TEST_Z(ec = rdma_create_event_channel());
-  TEST_NZ(rdma_create_id(ec, &conn, NULL, RDMA_PS_TCP));
-  TEST_NZ(rdma_resolve_addr(conn, NULL, addr->ai_addr, TIMEOUT_IN_MS));
 
-  context->base_id = conn;
-  for (auto &conn_ptr : context->cm_ids) {
-    TEST_NZ(rdma_create_id(ec, &conn_ptr, NULL, RDMA_PS_TCP));
-    // TEST_NZ(rdma_resolve_addr(conn_ptr, NULL, addr->ai_addr, TIMEOUT_IN_MS));
-    conn_ptr->context = context;
+  for (auto &server : context->servers) {
+    struct rdma_cm_id *conn = NULL;
+    TEST_NZ(getaddrinfo(server.host.c_str(), server.port.c_str(), NULL, &server.addr));
+    TEST_NZ(rdma_create_id(ec, &conn, NULL, RDMA_PS_TCP));
+    conn->context = context;
+    server.control_id = conn;
+    s_control_ids.push_back(conn);
+  }
+  for (auto const &server : context->servers) {
+    TEST_NZ(
+      rdma_resolve_addr(server.control_id, NULL, server.addr->ai_addr, TIMEOUT_IN_MS));
   }
 
-  // freeaddrinfo(addr);
-
-  context->addr = addr;
-  conn->context = context;
+  auto const n_data = context->cm_ids.size();
+  std::vector<struct rdma_event_channel *> data_ecs(std::min(DATA_CM_CHANNELS, n_data));
+  for (auto &data_ec : data_ecs) TEST_Z(data_ec = rdma_create_event_channel());
+  for (size_t i = 0; i < n_data; ++i) {
+    auto &conn_ptr = context->cm_ids[i];
+    TEST_NZ(rdma_create_id(data_ecs[i % data_ecs.size()], &conn_ptr, NULL, RDMA_PS_TCP));
+    conn_ptr->context = context;
+  }
+  std::vector<std::thread> data_threads;
+  for (size_t c = 0; c < data_ecs.size(); ++c) {
+    auto const n = n_data / data_ecs.size() + (c < n_data % data_ecs.size() ? 1 : 0);
+    data_threads.emplace_back(data_event_loop, data_ecs[c], n);
+  }
 
-  event_loop(ec, 1);// exit on disconnect
+  event_loop(ec, 1);// exit once every server has disconnected
 
+  for (auto &t : data_threads) t.join();
   rdma_destroy_event_channel(ec);
 }
 
-void rc_server_loop(const char *port)
+// Binds the listener to port and opens the RDMA device, so rc_get_pd() can register
+// memory before any client connects. Like the connections themselves, this assumes a
+// single device.
+void rc_server_bind(const char *port)
 {
   struct sockaddr_in6 addr;
-  struct rdma_cm_id *listener = NULL;
-  struct rdma_event_channel *ec = NULL;
 
   memset(&addr, 0, sizeof(addr));
   addr.sin6_family = AF_INET6;
   addr.sin6_port = htons(static_cast<uint16_t>(atoi(port)));
 
-  TEST_Z(ec = rdma_create_event_channel());
-  TEST_NZ(rdma_create_id(ec, &listener, NULL, RDMA_PS_TCP));
-  TEST_NZ(rdma_bind_addr(listener, reinterpret_cast<struct sockaddr *>(&addr)));
-  TEST_NZ(rdma_listen(listener, 10)); /* backlog=10 is arbitrary */
+  TEST_Z(s_listen_ec = rdma_create_event_channel());
+  TEST_NZ(rdma_create_id(s_listen_ec, &s_listener, NULL, RDMA_PS_TCP));
+  TEST_NZ(rdma_bind_addr(s_listener, reinterpret_cast<struct sockaddr *>(&addr)));
 
-  event_loop(ec, 1);// exit on disconnect
+  int num_devices = 0;
+  struct ibv_context **devices = rdma_get_devices(&num_devices);
+  if (!devices || num_devices == 0) rc_die("no RDMA device found");
+  if (num_devices > 1) {
+    BOOST_LOG_TRIVIAL(warning) << num_devices << " RDMA devices, serving on the first";
+  }
+  build_context(devices[0]);
+  rdma_free_devices(devices);
+}
 
-  rdma_destroy_id(listener);
-  rdma_destroy_event_channel(ec);
+// Serves clients one job after another until the process is stopped.
+void rc_server_loop()
+{
+  // a client connects all of its data QPs at once, from several threads
+  TEST_NZ(rdma_listen(s_listener, 1024));
+
+  event_loop(s_listen_ec, 0);
+
+  rdma_destroy_id(s_listener);
+  rdma_destroy_event_channel(s_listen_ec);
 }
 
 void rc_disconnect(struct rdma_cm_id *id) { rdma_disconnect(id); }
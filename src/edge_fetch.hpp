@@ -0,0 +1,920 @@
+#ifndef __PROJ_EDGE_FETCH_H__
+#define __PROJ_EDGE_FETCH_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
+#include <assert.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <infiniband/verbs.h>
+#include <boost/program_options.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <build_options.hpp>
+#include <client_runtime.hpp>
+#include <connection_utils.hpp>
+#include <messages.hpp>
+#include "adjacency_cache.hpp"
+#include "adjacency_codec.hpp"
+#include "shard_map.hpp"
+#include "bitmap.hpp"
+#include "frontier.hpp"
+#include "vertex_table.hpp"
+#include "communication_runtime.hpp"
+
+namespace famgraph {
+// Knobs of the edge fetch engine. The build options only supply the defaults, so one
+// binary can sweep every combination.
+struct fetch_config
+{
+  uint32_t wr_window;// max WR's in one window's chain
+  bool coalesce;// merge the reads of neighbouring active vertices
+  uint32_t coalesce_gap;// inactive vertices a WR may read through
+  uint32_t coalesce_bytes;// inactive adjacency bytes a WR may read through
+  uint32_t signal_interval;// signal every n'th WR of a chain so the send queue drains
+  uint32_t parts_per_worker;// edge-balanced parts per worker per round, 0 disables
+  uint32_t gather_bytes;// largest window served by a gather RPC, 0 disables gathering
+  uint32_t gather_min_wrs;// gather only windows needing at least this many READs
+  uint32_t gather_max_extent;// ... whose READs average at most this many bytes
+
+  enum class coalescing { OFF, ADJACENT, GAP };
+
+  coalescing mode() const noexcept
+  {
+    if (!coalesce) return coalescing::OFF;
+    return coalesce_gap == 0 ? coalescing::ADJACENT : coalescing::GAP;
+  }
+};
+
+// server_gather_bytes is the largest gather reply the server offered, 0 if none.
+inline fetch_config get_fetch_config(boost::program_options::variables_map const &vm,
+  uint32_t const server_gather_bytes)
+{
+  auto opt = [&vm](char const *name, uint32_t const fallback) {
+    return vm.count(name) ? vm[name].as<uint32_t>() : fallback;
+  };
+
+  fetch_config cfg{};
+  cfg.wr_window = opt("wr-window", build_options::opt_wr_window);
+  cfg.coalesce = vm.count("coalesce") ? vm["coalesce"].as<bool>()
+                                      : build_options::vertex_coalescing;
+  cfg.coalesce_gap = opt("coalesce-gap", build_options::opt_coalesce_gap);
+  cfg.coalesce_bytes = opt("coalesce-bytes", build_options::opt_coalesce_bytes);
+  cfg.signal_interval = opt("signal-interval", cfg.wr_window);
+  cfg.parts_per_worker = vm.count("no-edge-balance") ? 0 : opt("parts-per-worker", 8);
+  cfg.gather_bytes = vm.count("gather") ? server_gather_bytes : 0;
+  cfg.gather_min_wrs = std::max(opt("gather-min-wrs", 8), 2u);
+  cfg.gather_max_extent = opt("gather-max-extent", 1024);
+  if (vm.count("gather") && server_gather_bytes == 0) {
+    BOOST_LOG_TRIVIAL(warning) << "the server does not serve gathers, using READs only";
+  }
+
+  if (cfg.wr_window == 0) throw std::runtime_error("wr-window must be > 0");
+  if (cfg.signal_interval == 0) throw std::runtime_error("signal-interval must be > 0");
+
+  // every window of the deepest pipeline may be in one QP's send queue at once
+  auto const send_queue = rc_get_link_caps().max_send_wr;
+  if (send_queue && cfg.wr_window * MAX_PIPELINE_DEPTH > send_queue) {
+    cfg.wr_window = std::max(send_queue / MAX_PIPELINE_DEPTH, 1u);
+    cfg.signal_interval = std::min(cfg.signal_interval, cfg.wr_window);
+    BOOST_LOG_TRIVIAL(warning) << "wr-window cut to " << cfg.wr_window
+                               << " to fit a send queue of " << send_queue << " WR's";
+  }
+  return cfg;
+}
+
+// The part [start, end) of v's adjacency list (degree d) that is being delivered.
+struct v_interval
+{
+  std::uint32_t const v;// name
+  std::uint32_t const d;// degree of vertex
+  std::uint32_t const start;
+  std::uint32_t end;
+
+  v_interval(std::uint32_t t_v,
+    std::uint32_t t_d,
+    std::uint32_t t_start,
+    std::uint32_t t_end)
+    : v{ t_v }, d{ t_d }, start{ t_start }, end{ t_end }
+  {}
+};
+
+// Where a round's adjacency lists live: a remote edge array and the local index into
+// it. A slice restricts every list to its edges [slice_begin, slice_begin +
+// slice_len), e.g. to fetch only a prefix of each in-edge list. Lists held by cache
+// are served locally instead of being fetched. A source with a byte_index holds
+// compressed lists (adjacency_codec.hpp): its positions and stored sizes are in bytes
+// rather than edges, and it cannot be sliced.
+//
+// The edge array is either split across the memory servers by shards, or held whole
+// by server home, at remote_addr.
+struct edge_source
+{
+  famgraph::compact_index const *index;
+  uint32_t num_vertices;
+  uint64_t num_edges;
+  uint64_t remote_addr;
+  uint32_t rkey;
+  adjacency_cache *cache{ nullptr };
+  uint64_t const *byte_index{ nullptr };// num_vertices + 1 offsets into the .cadj
+  shard_map const *shards{ nullptr };
+  uint32_t home{ 0 };
+  uint32_t slice_begin{ 0 };
+  uint32_t slice_len{ std::numeric_limits<uint32_t>::max() };
+
+  bool sliced() const noexcept
+  {
+    return slice_begin > 0 || slice_len != std::numeric_limits<uint32_t>::max();
+  }
+
+  uint32_t degree(uint32_t const v) const noexcept
+  {
+    auto const d = famgraph::get_num_edges(v, index, num_vertices, num_edges);
+    if (d <= slice_begin) return 0;
+    return std::min(d - slice_begin, slice_len);
+  }
+
+  uint64_t offset(uint32_t const v) const noexcept
+  {
+    return index->offset(v) + slice_begin;
+  }
+
+  bool compressed() const noexcept { return byte_index != nullptr; }
+
+  uint32_t unit_bytes() const noexcept
+  {
+    return compressed() ? 1 : static_cast<uint32_t>(sizeof(uint32_t));
+  }
+
+  uint64_t position(uint32_t const v) const noexcept
+  {
+    return compressed() ? byte_index[v] : offset(v);
+  }
+
+  uint32_t stored_size(uint32_t const v) const noexcept
+  {
+    return compressed() ? static_cast<uint32_t>(byte_index[v + 1] - byte_index[v])
+                        : degree(v);
+  }
+
+  // The server holding the list at position pos.
+  uint32_t server_of(uint64_t const pos) const noexcept
+  {
+    return shards ? shards->find(pos) : home;
+  }
+
+  // Where byte offset of the edge array lives on server s, which must hold it.
+  uint64_t remote_address(uint32_t const s, uint64_t const offset) const noexcept
+  {
+    if (!shards) return remote_addr + offset;
+    auto const &shard = (*shards)[s];
+    return shard.remote_addr + offset - shard.first_edge * sizeof(uint32_t);
+  }
+
+  uint32_t remote_key(uint32_t const s) const noexcept
+  {
+    return shards ? (*shards)[s].rkey : rkey;
+  }
+
+  edge_source slice(uint32_t const begin, uint32_t const len) const noexcept
+  {
+    assert(!compressed());
+    auto s = *this;
+    s.cache = nullptr;// the cache holds whole lists only
+    s.slice_begin = begin;
+    s.slice_len = len;
+    return s;
+  }
+};
+
+struct vertex_range
+{
+  // interval of form [v_s, v_end] note the [
+  uint32_t v_s;
+  uint32_t v_e;
+};
+
+// One edge window of a worker's pipeline: the WR chain that fills it and the
+// vertices whose adjacency lists it holds. Allocated once per worker and pipeline
+// slot, so sg_list pointers into sge_window stay valid across rounds. All of a
+// window's WR's go to one server, over one of the worker's QPs to it.
+struct window_slot
+{
+  std::vector<struct ibv_send_wr> wr_window;
+  std::vector<vertex_range> vertex_batch;
+  std::vector<struct ibv_sge> sge_window;
+  uint32_t *edge_buf{ nullptr };
+  uint32_t wrs{ 0 };
+  uint32_t bytes{ 0 };// read into edge_buf
+  uint64_t seq{ 0 };// wr_id of the signaled tail WR
+  uint32_t server{ 0 };
+  uint32_t lane{ 0 };// which of the worker's QPs to server it went out on
+  // a window either holds whole adjacency lists, or the single chunk
+  // [chunk_start, chunk_end) of a list that does not fit (chunk_end > 0)
+  uint32_t chunk_start{ 0 };
+  uint32_t chunk_end{ 0 };
+  // lists packed into this window that were served by the adjacency cache
+  std::vector<std::pair<uint32_t, uint32_t *>> cached;
+  // registered space for this window's gather request, if gathering is on
+  gather_request *request{ nullptr };
+  uint32_t request_lkey{ 0 };
+
+  explicit window_slot(uint32_t const wr_window_size)
+    : wr_window(wr_window_size), vertex_batch(wr_window_size),
+      sge_window(wr_window_size)
+  {
+    cached.reserve(wr_window_size);
+  }
+};
+
+inline void prep_wr(window_slot &w,
+  uint32_t const idx,
+  edge_source const &src,
+  struct client_context *ctx,
+  void *const buffer,
+  uint32_t const length,
+  uint64_t const remote_offset) noexcept
+{
+
+  struct ibv_send_wr &wr = w.wr_window[idx];
+  struct ibv_sge &sge = w.sge_window[idx];
+  memset(&wr, 0, sizeof(wr));// maybe optimize away
+
+  wr.opcode = IBV_WR_RDMA_READ;
+  wr.send_flags = 0;// only the tail of the chain is signaled, see seal_window
+  wr.wr.rdma.remote_addr = src.remote_address(w.server, remote_offset);
+  wr.wr.rdma.rkey = src.remote_key(w.server);
+
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  sge.addr = reinterpret_cast<uintptr_t>(buffer);
+  sge.length = length;
+  sge.lkey = ctx->heap_mr->lkey;
+
+  if (idx > 0) {
+    struct ibv_send_wr &prev = w.wr_window[idx - 1];
+    prev.next = &wr;
+  }
+}
+
+// Signals the last WR of w's chain and tags it so the worker can tell when the whole
+// window has landed. An RC send queue completes in order, so the tail completion
+// implies every READ before it in the chain is done as well. Long chains are also
+// signaled every signal_interval WR's (with wr_id 0) to recycle send queue slots.
+inline void seal_window(window_slot &w,
+  uint32_t const signal_interval,
+  famgraph::completion_ring &ring) noexcept
+{
+  for (uint32_t i = signal_interval - 1; i + 1 < w.wrs; i += signal_interval) {
+    w.wr_window[i].send_flags = IBV_SEND_SIGNALED;
+  }
+
+  auto &tail = w.wr_window[w.wrs - 1];
+  w.seq = ring.next_seq();
+  tail.wr_id = w.seq;
+  tail.send_flags = IBV_SEND_SIGNALED;
+}
+
+// A window of many short scattered lists costs one READ per list, and the NIC runs
+// out of IOPS before bandwidth. Such a window is instead sent to the server as one
+// gather request naming the READs' extents; the server writes them back to back into
+// edge_buf, exactly where the READs would have put them, so draining is unchanged.
+// The reply's immediate data completes w.seq. Returns false, posting nothing, if the
+// window is better served by its READ chain.
+static_assert(GATHER_SLOTS >= MAX_PIPELINE_DEPTH,
+  "every window of a worker may have a gather reply outstanding");
+inline bool post_gather(window_slot &w,
+  fetch_config const &cfg,
+  struct ibv_qp *const qp,
+  famgraph::completion_ring &ring,
+  struct client_context *const ctx) noexcept
+{
+  if (cfg.gather_bytes == 0 || w.request == nullptr || w.chunk_end > 0) return false;
+  if (w.wrs < cfg.gather_min_wrs || w.wrs > GATHER_MAX_EXTENTS) return false;
+
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < w.wrs; ++i) bytes += w.sge_window[i].length;
+  if (bytes > cfg.gather_bytes || bytes > uint64_t{ w.wrs } * cfg.gather_max_extent) {
+    return false;
+  }
+
+  auto &req = *w.request;
+  for (uint32_t i = 0; i < w.wrs; ++i) {
+    req.extents[i] = { w.wr_window[i].wr.rdma.remote_addr, w.sge_window[i].length, 0 };
+  }
+  w.seq = ring.next_seq();
+  req.reply_addr = w.sge_window[0].addr;
+  req.reply_rkey = ctx->heap_mr->rkey;
+  req.seq = static_cast<uint32_t>(w.seq);
+  req.count = w.wrs;
+  req.bytes = static_cast<uint32_t>(bytes);
+
+  struct ibv_send_wr wr, *bad_wr = NULL;
+  struct ibv_sge sge;
+  memset(&wr, 0, sizeof(wr));
+  wr.opcode = IBV_WR_SEND;
+  wr.send_flags = IBV_SEND_SIGNALED;// wr_id 0: reaped, but nobody waits on it
+  wr.sg_list = &sge;
+  wr.num_sge = 1;
+  sge.addr = reinterpret_cast<uintptr_t>(&req);
+  sge.length = static_cast<uint32_t>(
+    offsetof(gather_request, extents) + w.wrs * sizeof(gather_extent));
+  sge.lkey = w.request_lkey;
+  TEST_NZ(ibv_post_send(qp, &wr, &bad_wr));
+
+  auto &g = ctx->stats.gathers.local();
+  g.first++;
+  g.second += w.wrs;
+  return true;
+}
+
+// Reading through a short run of inactive vertices costs their adjacency bytes but
+// saves a WR. Returns the number of edges (bytes, if compressed) to read through to
+// merge v into last, or -1 when v should start a new WR. Only valid for unsliced
+// sources.
+template<fetch_config::coalescing C>
+int64_t coalesce_gap(vertex_range const &last,
+  uint32_t const v,
+  edge_source const &src,
+  fetch_config const &cfg) noexcept
+{
+  if constexpr (C == fetch_config::coalescing::OFF) {
+    return -1;
+  } else {
+    uint32_t const gap = v - last.v_e - 1;
+    if (gap == 0) return 0;
+    if constexpr (C == fetch_config::coalescing::ADJACENT) {
+      return -1;
+    } else {
+      if (gap > cfg.coalesce_gap) return -1;
+
+      auto const gap_units = src.position(v) - src.position(last.v_e + 1);
+      if (gap_units * src.unit_bytes() > cfg.coalesce_bytes) return -1;
+      return static_cast<int64_t>(gap_units);
+    }
+  }
+}
+
+// Fills w with the next chunk of v's adjacency list, which is larger than the whole
+// edge window. chunk_cursor carries the edges (bytes, if compressed) already fetched
+// between calls; compressed lists are cut at frame boundaries. Returns true once the
+// last chunk has been packed.
+inline bool pack_chunk(window_slot &w,
+  uint32_t const capacity,
+  edge_source const &src,
+  uint32_t const v,
+  uint32_t const size,
+  uint32_t &chunk_cursor,
+  struct client_context *const ctx) noexcept
+{
+  uint32_t const room =
+    src.compressed() ? capacity - capacity % codec::FRAME_BYTES : capacity;
+  uint32_t const take = std::min(size - chunk_cursor, room);
+  w.vertex_batch[0].v_s = v;
+  w.vertex_batch[0].v_e = v;
+  prep_wr(w,
+    0,
+    src,
+    ctx,
+    w.edge_buf,
+    take * src.unit_bytes(),
+    (src.position(v) + chunk_cursor) * src.unit_bytes());
+  w.wrs = 1;
+  w.chunk_start = chunk_cursor;
+  w.chunk_end = chunk_cursor + take;
+  ++ctx->stats.chunk_windows.local();
+
+  chunk_cursor += take;
+  if (chunk_cursor < size) return false;
+  chunk_cursor = 0;
+  return true;
+}
+
+// is_active for a dense frontier scanned by vertex ID. Scans jump from one set bit to
+// the next instead of testing every vertex.
+struct active_bits
+{
+  Bitmap const &bits;
+
+  unsigned long operator()(uint32_t const v) const noexcept { return bits.get_bit(v); }
+};
+
+// The first position in [i, end) that may be active. Only active_bits can skip, and
+// it is only used with positions that are vertex IDs.
+template<typename Active>
+inline uint32_t skip_inactive(Active const &is_active,
+  uint32_t const i,
+  uint32_t const end) noexcept
+{
+  if constexpr (std::is_same_v<Active, active_bits>) {
+    return is_active.bits.next_set_bit(i, end);
+  } else {
+    return i;
+  }
+}
+
+// Fills w with WR's for the active vertices among vertex_at(i), i in
+// [range_start, range_end), until the edge buffer or the WR window is full. vertex_at
+// is the identity when scanning a dense frontier and indexes the sorted vertex list of
+// a sparse one. Lists found in the adjacency cache take no WR or buffer space; a
+// window holds at most wr_window of them. A compressed list fills the window with its
+// bytes, but must also decode into edge_buf_size edges to be packed whole. Returns the
+// first position that was not packed, or the position of the oversized vertex whose
+// next chunk is still due. A window only reads from one server, so it also ends at
+// the first list held by another.
+template<fetch_config::coalescing C, typename At, typename Active>
+uint32_t pack_window(window_slot &w,
+  fetch_config const &cfg,
+  uint32_t const edge_buf_size,
+  edge_source const &src,
+  uint32_t const range_start,
+  uint32_t const range_end,
+  uint32_t &chunk_cursor,
+  At const &vertex_at,
+  Active const &is_active,
+  struct client_context *const ctx) noexcept
+{
+  auto &vertex_batch = w.vertex_batch;
+  auto &sge_window = w.sge_window;
+  uint32_t const unit = src.unit_bytes();
+  uint32_t const capacity =
+    edge_buf_size * static_cast<uint32_t>(sizeof(uint32_t)) / unit;
+  auto *const buf = reinterpret_cast<uint8_t *>(w.edge_buf);
+  uint32_t total = 0;// edges, or bytes of compressed lists
+  uint32_t batch_size = 0;
+  uint32_t wrs = 0;
+  uint64_t wasted = 0;
+  uint64_t wrs_saved = 0;
+  uint64_t packed_edges = 0;
+  uint32_t i = range_start;
+  bool after_hit = false;// a cached list must not be read through by the next WR
+  w.chunk_end = 0;
+  w.server = src.home;
+  w.cached.clear();
+  while ((total < capacity) && (wrs < cfg.wr_window) && (i < range_end)) {
+    i = skip_inactive(is_active, i, range_end);
+    if (i == range_end) break;
+    uint32_t const v = vertex_at(i);
+    if (is_active(v)) {
+      uint32_t const n_out_edge = src.degree(v);
+      if (src.cache && n_out_edge > 0 && chunk_cursor == 0) {
+        if (auto *const edges = src.cache->lookup(v, n_out_edge)) {
+          if (w.cached.size() == cfg.wr_window) break;
+          w.cached.emplace_back(v, edges);
+          after_hit = true;
+          i++;
+          continue;
+        }
+      }
+
+      if (src.shards && n_out_edge > 0) {
+        uint32_t const server = src.server_of(src.position(v));
+        if (wrs == 0) {
+          w.server = server;
+        } else if (server != w.server) {
+          break;
+        }
+      }
+
+      uint32_t const size = src.stored_size(v);
+      bool const oversized = size > capacity || n_out_edge > edge_buf_size;
+      if (total + size > capacity || oversized) {
+        if (wrs == 0 && w.cached.empty() && oversized) {
+          if (chunk_cursor == 0) {
+            batch_size++;
+            packed_edges += n_out_edge;
+          }
+          if (pack_chunk(w, capacity, src, v, size, chunk_cursor, ctx)) i++;
+          wrs = w.wrs;
+          total = w.chunk_end - w.chunk_start;
+        }
+        break;// next one up
+      }
+
+      if (n_out_edge > 0) {
+        auto const gap = wrs > 0 && !after_hit
+                           ? coalesce_gap<C>(vertex_batch[wrs - 1], v, src, cfg)
+                           : -1;
+        auto const through = static_cast<uint32_t>(gap);
+        if (gap >= 0 && total + through + size <= capacity) {
+          if (v != vertex_batch[wrs - 1].v_e + 1) wrs_saved++;// read through a gap
+          vertex_batch[wrs - 1].v_e = v;
+          sge_window[wrs - 1].length += (through + size) * unit;
+          total += through;
+          wasted += through;
+        } else {
+          vertex_batch[wrs].v_s = v;
+          vertex_batch[wrs].v_e = v;
+          prep_wr(
+            w, wrs, src, ctx, buf + total * unit, size * unit, src.position(v) * unit);
+          wrs++;
+        }
+
+        after_hit = false;
+        batch_size++;
+        packed_edges += n_out_edge;
+        total += size;
+      }
+    }
+    i++;
+  }
+
+  w.wrs = wrs;
+  w.bytes = total * unit;
+  std::get<0>(ctx->stats.wrs_verts_sends.local()) += wrs;
+  std::get<1>(ctx->stats.wrs_verts_sends.local()) += batch_size;
+  std::get<2>(ctx->stats.wrs_verts_sends.local())++;
+  auto &amp = ctx->stats.read_amplification.local();
+  std::get<0>(amp) += uint64_t{ total } * unit;
+  std::get<1>(amp) += wasted * unit;
+  std::get<2>(amp) += wrs_saved;
+  if (src.compressed()) {
+    auto &comp = ctx->stats.compressed_reads.local();
+    comp.first += uint64_t{ total } * unit;
+    comp.second += packed_edges;
+  }
+  return i;
+}
+
+// Cuts positions [begin, end) into about `parts` contiguous parts of equal active edge
+// volume, using prefix sums of per-block degree totals. Returns the part boundaries,
+// begin first and end last. A part never splits a vertex, so a hub still streams all
+// its chunks through one worker.
+template<typename At, typename Active>
+std::vector<uint32_t> edge_balanced_splits(uint32_t const begin,
+  uint32_t const end,
+  uint32_t const parts,
+  edge_source const &src,
+  At const &vertex_at,
+  Active const &is_active)
+{
+  uint32_t const n = end - begin;
+  uint32_t const block = std::clamp(n / (parts * 8), 1u, 1024u);
+  uint32_t const n_blocks = (n + block - 1) / block;
+
+  std::vector<uint64_t> prefix(n_blocks + 1, 0);
+  tbb::parallel_for(tbb::blocked_range<uint32_t>(0, n_blocks), [&](auto const &range) {
+    for (uint32_t b = range.begin(); b < range.end(); ++b) {
+      uint32_t const b_end = std::min(begin + (b + 1) * block, end);
+      uint64_t edges = 0;
+      for (uint32_t i = skip_inactive(is_active, begin + b * block, b_end); i < b_end;
+           i = skip_inactive(is_active, i + 1, b_end)) {
+        uint32_t const v = vertex_at(i);
+        if (is_active(v)) edges += src.degree(v);
+      }
+      prefix[b + 1] = edges;
+    }
+  });
+  for (uint32_t b = 0; b < n_blocks; ++b) prefix[b + 1] += prefix[b];
+
+  uint64_t const target = std::max(prefix[n_blocks] / parts, uint64_t{ 1 });
+  std::vector<uint32_t> splits{ begin };
+  uint64_t next_cut = target;
+  for (uint32_t b = 1; b < n_blocks; ++b) {
+    if (prefix[b] >= next_cut) {
+      splits.push_back(begin + b * block);
+      next_cut = (prefix[b] / target + 1) * target;
+    }
+  }
+  splits.push_back(end);
+  return splits;
+}
+
+// Edge functions that also take a v_interval see which part of the adjacency list
+// they were handed, and may keep state across the chunks of an oversized list.
+// Others are called once per chunk as if it were the whole list.
+template<typename F>
+inline constexpr bool is_chunk_aware_v = std::
+  is_invocable_v<F const &, uint32_t, uint32_t *, uint32_t, v_interval const &>;
+
+template<typename F>
+void deliver(F const &function,
+  uint32_t const v,
+  uint32_t *const edges,
+  uint32_t const n,
+  v_interval const &part) noexcept
+{
+  if constexpr (is_chunk_aware_v<F>) {
+    function(v, edges, n, part);
+  } else {
+    function(v, edges, n);
+  }
+}
+
+// Waits for w's tail completion, then hands each adjacency list to function, followed
+// by the lists w took from the adjacency cache. Vertices a WR only read through to
+// bridge a gap are skipped. The chunks of an oversized list arrive in order, in
+// consecutive windows of the same worker. Fetched lists are offered to the cache,
+// which keeps those it reserved a slot for.
+//
+// Compressed lists are decoded into the worker's scratch buffer first. A chunk of a
+// compressed list is handed over frame by frame, and chunk_pos carries the edge
+// position from one chunk to the next.
+template<typename F, typename Active>
+void drain_window(window_slot const &w,
+  edge_source const &src,
+  Active const &is_active,
+  uint32_t const in_flight,
+  struct rdma_cm_id *const id,
+  famgraph::completion_ring &ring,
+  bool const use_events,
+  uint32_t *const scratch,
+  uint32_t &chunk_pos,
+  struct client_context *const ctx,
+  F const &function) noexcept
+{
+  struct timespec t1, t2, res;
+  if (w.wrs == 0 && w.cached.empty()) return;
+
+  if (w.wrs > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    famgraph::wait_for_completion(id, ring, w.seq, use_events);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    famgraph::timespec_diff(&t2, &t1, &res);
+    long const spin = res.tv_sec * 1000000000L + res.tv_nsec;
+    ctx->stats.spin_time.local() += spin;
+    ctx->stats.spin_by_depth.local()[in_flight - 1] += spin;
+  }
+
+  auto hand_over = [&](uint32_t const v,
+                     uint32_t const d,
+                     uint32_t *const edges,
+                     uint32_t const start,
+                     uint32_t const n) {
+    if (src.cache) src.cache->fill(v, d, edges, start, n);
+    deliver(function, v, edges, n, v_interval{ v, d, start, start + n });
+  };
+
+  auto const *const bytes = reinterpret_cast<uint8_t const *>(w.edge_buf);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (w.chunk_end > 0) {
+    uint32_t const v = w.vertex_batch[0].v_s;
+    uint32_t const d = src.degree(v);
+    if (src.compressed()) {
+      if (w.chunk_start == 0) chunk_pos = 0;
+      uint32_t const len = w.chunk_end - w.chunk_start;
+      for (uint32_t f = 0; f < len; f += codec::FRAME_BYTES) {
+        uint32_t const n = codec::decode_frame(bytes + f, len - f, scratch);
+        hand_over(v, d, scratch, chunk_pos, n);
+        chunk_pos += n;
+      }
+    } else {
+      hand_over(v, d, w.edge_buf, w.chunk_start, w.chunk_end - w.chunk_start);
+    }
+  } else {
+    uint32_t pos = 0;// into the window, in edges or bytes
+    for (uint32_t i = 0; i < w.wrs; ++i) {
+      for (uint32_t v = w.vertex_batch[i].v_s; v <= w.vertex_batch[i].v_e; v++) {
+        uint32_t const n_edges = src.degree(v);
+        uint32_t const size = src.stored_size(v);
+        if (n_edges > 0 && is_active(v)) {
+          if (src.compressed()) {
+            codec::decode_list(bytes + pos, size, scratch, n_edges);
+            hand_over(v, n_edges, scratch, 0, n_edges);
+          } else {
+            hand_over(v, n_edges, w.edge_buf + pos, 0, n_edges);
+          }
+        }
+        pos += size;
+      }
+    }
+  }
+  for (auto const &[v, edges] : w.cached) {
+    if (!is_active(v)) continue;
+    uint32_t const d = src.degree(v);
+    deliver(function, v, edges, d, v_interval{ v, d, 0, d });
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  famgraph::timespec_diff(&t2, &t1, &res);
+  ctx->stats.function_time.local() += res.tv_sec * 1000000000L + res.tv_nsec;
+}
+
+namespace single_buffer {
+  // Each worker keeps up to c.pipeline_depth edge windows in flight: while window k is
+  // handed to function, windows k+1..k+depth-1 are already being read by the NIC.
+  // A drained window is immediately repacked and reposted, so the QP never idles
+  // while the worker is computing.
+  template<fetch_config::coalescing C,
+    typename F,
+    typename At,
+    typename Active,
+    typename Context>
+  void for_each_window(tbb::blocked_range<uint32_t> const my_range,
+    edge_source const &src,
+    At const &vertex_at,
+    Active const &is_active,
+    Context &c,
+    F const &function) noexcept
+  {
+    auto const edge_buf_size = c.edge_buf_size;
+    auto const depth = c.pipeline_depth;
+    auto const use_events = c.use_cq_events;
+    auto const &cfg = c.fetch;
+    auto ctx = c.context;
+
+    // Each task walks the contiguous positions of the parts it was given. Parts carry
+    // equal edge volume, and TBB steals whole parts from busy workers.
+    auto run = [&](uint32_t const range_begin, uint32_t const range_end) {
+      size_t const worker_id =
+        static_cast<size_t>(tbb::this_task_arena::current_thread_index());
+      // the worker's QPs and rings, one per lane and server; windows take the lanes
+      // in turn, so more reads are in flight than one QP's send queue allows
+      struct rdma_cm_id *const *const ids = &ctx->cm_ids[ctx->data_qp(worker_id, 0)];
+      famgraph::completion_ring *const rings = &ctx->rings[ctx->data_qp(worker_id, 0)];
+      auto const lanes = static_cast<uint32_t>(ctx->qps_per_worker);
+      auto const n_servers = static_cast<uint32_t>(ctx->servers.size());
+      uint32_t next_lane = 0;
+      window_slot *const slots = c.windows.data() + (worker_id * depth);
+
+      uint32_t *const scratch =
+        src.compressed() ? c.decode_bufs[worker_id].data() : nullptr;
+      // per-node counters, null unless --numa-aware
+      auto const node_id = ctx->numa ? ctx->numa->node_of(worker_id) : -1;
+      node_counters *const node = node_id >= 0 && node_id < ctx->stats.num_nodes
+                                    ? &ctx->stats.per_node[static_cast<size_t>(node_id)]
+                                    : nullptr;
+      auto const started = node ? std::chrono::steady_clock::now()
+                                : std::chrono::steady_clock::time_point{};
+      uint32_t next_range_start = range_begin;
+      uint32_t chunk_cursor = 0;
+      uint32_t chunk_pos = 0;
+      auto post_window = [&](window_slot &w) {
+        next_range_start = pack_window<C>(w,
+          cfg,
+          edge_buf_size,
+          src,
+          next_range_start,
+          range_end,
+          chunk_cursor,
+          vertex_at,
+          is_active,
+          ctx);
+        w.lane = next_lane;
+        next_lane = next_lane + 1 == lanes ? 0 : next_lane + 1;
+        auto const k = w.lane * n_servers + w.server;
+        struct ibv_qp *const qp = ids[k]->qp;
+        auto &ring = rings[k];
+        if (w.wrs > 0 && !post_gather(w, cfg, qp, ring, ctx)) {
+          seal_window(w, cfg.signal_interval, ring);
+          struct ibv_send_wr *bad_wr = NULL;
+          TEST_NZ(ibv_post_send(qp, &w.wr_window[0], &bad_wr));
+        }
+      };
+
+      uint32_t in_flight = 0;
+      for (; in_flight < depth && next_range_start < range_end; ++in_flight) {
+        post_window(slots[in_flight]);
+      }
+
+      for (uint32_t head = 0; in_flight > 0; head = (head + 1) % depth) {
+        auto &w = slots[head];
+        drain_window(w,
+          src,
+          is_active,
+          in_flight,
+          ids[w.lane * n_servers + w.server],
+          rings[w.lane * n_servers + w.server],
+          use_events,
+          scratch,
+          chunk_pos,
+          ctx,
+          function);
+        if (node) {
+          node->bytes.fetch_add(w.bytes, std::memory_order_relaxed);
+          node->windows.fetch_add(1, std::memory_order_relaxed);
+        }
+        --in_flight;
+        if (next_range_start < range_end) {
+          post_window(w);
+          ++in_flight;
+        }
+      }
+      if (node) {
+        std::chrono::nanoseconds const busy = std::chrono::steady_clock::now() - started;
+        node->busy.fetch_add(busy.count(), std::memory_order_relaxed);
+      }
+    };
+
+    if (cfg.parts_per_worker == 0 || my_range.empty()) {
+      tbb::parallel_for(
+        my_range, [&](auto const &range) { run(range.begin(), range.end()); });
+    } else {
+      auto const parts = static_cast<uint32_t>(c.num_workers) * cfg.parts_per_worker;
+      auto const splits = edge_balanced_splits(
+        my_range.begin(), my_range.end(), parts, src, vertex_at, is_active);
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, splits.size() - 1, 1),
+        [&](auto const &range) { run(splits[range.begin()], splits[range.end()]); });
+    }
+    if (src.cache) src.cache->end_round();
+    print_stats_round(ctx->stats);
+    clear_stats_round(ctx->stats);
+  }
+
+  // Instantiates the window loop for the configured coalescing mode, so the common
+  // configurations run without per-vertex policy checks. Sliced lists are not
+  // contiguous in the edge array, so they are never coalesced.
+  template<typename F, typename At, typename Active, typename Context>
+  void for_each_window(tbb::blocked_range<uint32_t> const my_range,
+    edge_source const &src,
+    At const &vertex_at,
+    Active const &is_active,
+    Context &c,
+    F const &function) noexcept
+  {
+    using mode = fetch_config::coalescing;
+    switch (src.sliced() ? mode::OFF : c.fetch.mode()) {
+    case mode::OFF:
+      for_each_window<mode::OFF>(my_range, src, vertex_at, is_active, c, function);
+      break;
+    case mode::ADJACENT:
+      for_each_window<mode::ADJACENT>(my_range, src, vertex_at, is_active, c, function);
+      break;
+    case mode::GAP:
+      for_each_window<mode::GAP>(my_range, src, vertex_at, is_active, c, function);
+      break;
+    }
+  }
+
+  template<typename F, typename Context>
+  void for_each_active_batch(Bitmap const &frontier,
+    tbb::blocked_range<uint32_t> const my_range,
+    edge_source const &src,
+    Context &c,
+    F const &function) noexcept
+  {
+    auto identity = [](uint32_t const i) { return i; };
+    for_each_window(my_range, src, identity, active_bits{ frontier }, c, function);
+  }
+
+  // A sparse frontier is packed straight from its sorted vertex list, so a round
+  // with a handful of active vertices costs O(active) rather than a scan of my_range.
+  template<typename F, typename Context>
+  void for_each_active_batch(Frontier &frontier,
+    tbb::blocked_range<uint32_t> const my_range,
+    edge_source const &src,
+    Context &c,
+    F const &function) noexcept
+  {
+    if (!frontier.is_sparse()) {
+      for_each_active_batch(frontier.dense(), my_range, src, c, function);
+      return;
+    }
+
+    auto const &list = frontier.sorted_vertices();
+    auto const first = static_cast<uint32_t>(
+      std::lower_bound(list.begin(), list.end(), my_range.begin()) - list.begin());
+    auto const last = static_cast<uint32_t>(
+      std::lower_bound(list.begin(), list.end(), my_range.end()) - list.begin());
+    BOOST_LOG_TRIVIAL(debug) << "sparse frontier: " << last - first << " vertices";
+
+    auto vertex_at = [&list](uint32_t const i) { return list[i]; };
+    auto is_active = [&frontier](uint32_t const v) { return frontier.get_bit(v); };
+    tbb::blocked_range<uint32_t> const positions(first, last);
+    for_each_window(positions, src, vertex_at, is_active, c, function);
+  }
+
+  template<typename F, typename Frontier_t, typename Context>
+  void for_each_active_batch(Frontier_t &frontier,
+    tbb::blocked_range<uint32_t> const my_range,
+    Context &c,
+    F const &function) noexcept
+  {
+    for_each_active_batch(frontier, my_range, c.out_edges, c, function);
+  }
+
+  // Fetches the lists of every vertex in my_range that satisfies pred, e.g. the
+  // in-edges of the unvisited vertices in a bottom-up BFS step.
+  template<typename F, typename Pred, typename Context>
+  void for_each_matching(tbb::blocked_range<uint32_t> const my_range,
+    edge_source const &src,
+    Pred const &pred,
+    Context &c,
+    F const &function) noexcept
+  {
+    auto identity = [](uint32_t const i) { return i; };
+    for_each_window(my_range, src, identity, pred, c, function);
+  }
+
+  template<typename F, typename Context>
+  void for_each_range(tbb::blocked_range<uint32_t> const my_range,
+    Context &c,
+    F const &function) noexcept
+  {
+    auto all_active = [](uint32_t const) { return true; };
+    for_each_matching(my_range, c.out_edges, all_active, c, function);
+  }
+}// namespace single_buffer
+}// namespace famgraph
+
+#endif// __PROJ_EDGE_FETCH_H__
@@ -9,6 +9,7 @@
 #pragma GCC diagnostic pop
 
 #include "bitmap.hpp"
+#include "edge_fetch.hpp"
 #include "vertex_table.hpp"
 #include "communication_runtime.hpp"
 #include <vector>
@@ -29,30 +30,12 @@ public:
   {}
   auto operator()() noexcept
   {
-    while (from_inclusive < end_exclusive) {
-      auto const prev = from_inclusive++;
-      if (this->b.get_bit(prev)) return prev;
-    }
-
-    return end_exclusive;
+    auto const next = this->b.next_set_bit(from_inclusive, end_exclusive);
+    from_inclusive = next < end_exclusive ? next + 1 : end_exclusive;
+    return next;
   }
 };
 
-struct v_interval
-{
-  std::uint32_t const v;// name
-  std::uint32_t const d;// degree of vertex
-  std::uint32_t const start;
-  std::uint32_t end;
-
-  v_interval(std::uint32_t t_v,
-    std::uint32_t t_d,
-    std::uint32_t t_start,
-    std::uint32_t t_end)
-    : v{ t_v }, d{ t_d }, start{ t_start }, end{ t_end }
-  {}
-};
-
 class next_batch
 {
   famgraph::Bitmap const &b;
@@ -127,18 +110,6 @@ inline auto coalesce_intervals(std::vector<v_interval> const &vec) noexcept
 }
 
 
-inline void sign_buffer(std::vector<v_interval> const &vec,
-  uint32_t *const buffer) noexcept
-{
-  auto b = buffer;
-  for (auto &interval : vec) {
-    auto const edges = interval.end - interval.start;
-    b[0] = famgraph::NULL_VERT;
-    b[edges - 1] = famgraph::NULL_VERT;
-    b += edges;
-  }
-}
-
 inline auto make_WRs(std::vector<v_interval> const &vec,
   std::uint32_t const rkey,
   std::uint32_t const lkey,
@@ -175,14 +146,20 @@ inline auto make_WRs(std::vector<v_interval> const &vec,
   return WRs;
 }
 
-inline void post_all(std::vector<WR> &WRs, ibv_qp *qp) noexcept
+// Posts WRs in chains of signal_interval. Every chain tail is signaled so the send
+// queue drains, but only the final one carries a wr_id. Returns that wr_id.
+inline auto post_all(std::vector<WR> &WRs,
+  ibv_qp *qp,
+  uint32_t const signal_interval,
+  famgraph::completion_ring &ring) noexcept
 {
+  auto const seq = ring.next_seq();
   ibv_send_wr *wr = &WRs[0].wr;
   for (size_t i = 0; i < WRs.size(); ++i) {
     auto &my_wr = WRs[i].wr;
-    if ((i % famgraph::WR_WINDOW_SIZE == famgraph::WR_WINDOW_SIZE - 1)
-        || (i == WRs.size() - 1)) {
+    if ((i % signal_interval == signal_interval - 1) || (i == WRs.size() - 1)) {
       my_wr.send_flags = IBV_SEND_SIGNALED;
+      my_wr.wr_id = i == WRs.size() - 1 ? seq : 0;
       my_wr.next = nullptr;
 
       ibv_send_wr *bad_wr = nullptr;
@@ -192,6 +169,8 @@ inline void post_all(std::vector<WR> &WRs, ibv_qp *qp) noexcept
       my_wr.next = &WRs[i + 1].wr;
     }
   }
+
+  return seq;
 }
 
 template<typename F>
@@ -209,12 +188,17 @@ void edgemap(famgraph::Bitmap const &frontier,
       v, vtable, ctx->app->num_vertices, ctx->app->num_edges);
   };
 
+  auto const use_events = ctx->vm->count("cq-events") ? true : false;
+  auto const signal_interval = famgraph::get_fetch_config(*ctx->vm, 0).signal_interval;
+
   std::cerr << "Edgemap()" << std::endl;
 
   tbb::parallel_for(my_range, [&](auto const &range) noexcept {
     auto const worker_id =
       static_cast<size_t>(tbb::this_task_arena::current_thread_index());
-    auto qp = (ctx->cm_ids)[worker_id]->qp;
+    auto id = (ctx->cm_ids)[ctx->data_qp(worker_id, 0)];// unsharded: server 0
+    auto qp = id->qp;
+    auto &ring = ctx->rings[ctx->data_qp(worker_id, 0)];
     auto const rkey = ctx->peer_rkey;
     auto const lkey = ctx->heap_mr->lkey;
     auto const edge_buf = RDMA_area + (worker_id * edge_buf_size);
@@ -228,21 +212,16 @@ void edgemap(famgraph::Bitmap const &frontier,
       // std::cerr << "C" << std::endl;
       if (intervals.empty()) continue;
 
-      // std::cerr << "signing" << std::endl;
-      sign_buffer(intervals, edge_buf);
       auto const combined = coalesce_intervals(intervals);
       auto WRs = make_WRs(combined, rkey, lkey, ctx->peer_addr, vtable, edge_buf);
-      post_all(WRs, qp);
+      auto const seq = post_all(WRs, qp, signal_interval, ring);
 
       // std::cerr << "done posting" << std::endl;
-      uint32_t volatile *e_buf = edge_buf;
+      famgraph::wait_for_completion(id, ring, seq, use_events);
+      uint32_t *e_buf = edge_buf;
       for (auto &interval : intervals) {
         auto const edges = interval.end - interval.start;
-        while (e_buf[0] == famgraph::NULL_VERT) {}
-        while (e_buf[edges - 1] == famgraph::NULL_VERT) {}
-        // std::cerr << "done spinning" << std::endl;
-        std::atomic_thread_fence(std::memory_order_seq_cst);
-        function(interval.v, const_cast<uint32_t *const>(e_buf), edges, interval.d);
+        function(interval.v, e_buf, edges, interval.d);
         e_buf += edges;
       }
     }
@@ -0,0 +1,107 @@
+#ifndef __PROJ_FRONTIER_H__
+#define __PROJ_FRONTIER_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "bitmap.hpp"
+
+namespace famgraph {
+// A frontier that stays sparse while few vertices are active: besides the dense
+// Bitmap it records every newly set vertex in a per-thread list, until more than
+// size / SPARSE_DIVISOR vertices are set. A sparse frontier is iterated from its
+// sorted list and cleared word by word, so BFS tails and late k-core rounds no
+// longer pay O(V) per round.
+class Frontier
+{
+public:
+  static constexpr uint32_t SPARSE_DIVISOR = 256;
+
+private:
+  Bitmap bits;
+  tbb::enumerable_thread_specific<std::vector<uint32_t>> lists;
+  std::vector<uint32_t> sorted;// lists merged by sorted_vertices()
+  std::atomic<uint32_t> listed{ 0 };
+  std::atomic<bool> overflowed{ false };
+  uint32_t const threshold;
+
+public:
+  uint32_t const size;
+
+  Frontier(uint32_t const t_size)
+    : bits{ t_size }, threshold{ std::max(t_size / SPARSE_DIVISOR, 1u) }, size{ t_size }
+  {
+    bits.clear();
+  }
+
+  Bitmap const &dense() const noexcept { return bits; }
+
+  bool is_sparse() const noexcept { return !overflowed.load(std::memory_order_relaxed); }
+
+  unsigned long get_bit(uint32_t const i) const noexcept { return bits.get_bit(i); }
+
+  unsigned long set_bit(uint32_t const i) noexcept
+  {
+    auto const was_unset = bits.set_bit(i);
+    if (was_unset && is_sparse()) {
+      if (listed.fetch_add(1, std::memory_order_relaxed) < threshold) {
+        lists.local().push_back(i);
+      } else {
+        overflowed.store(true, std::memory_order_relaxed);
+      }
+    }
+    return was_unset;// true if the bit was not previously set
+  }
+
+  void set_all() noexcept
+  {
+    bits.set_all();
+    overflowed.store(true, std::memory_order_relaxed);
+  }
+
+  void clear() noexcept
+  {
+    if (is_sparse()) {
+      for (auto &list : lists) {
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, list.size()),
+          [&](auto const &range) {
+            for (size_t j = range.begin(); j < range.end(); ++j) {
+              bits.clear_word(list[j]);
+            }
+          });
+      }
+      bits.clear_count();
+    } else {
+      bits.clear();
+    }
+
+    for (auto &list : lists) list.clear();
+    sorted.clear();
+    listed.store(0, std::memory_order_relaxed);
+    overflowed.store(false, std::memory_order_relaxed);
+  }
+
+  // Only meaningful while is_sparse(). Call between rounds, not while bits are set.
+  std::vector<uint32_t> const &sorted_vertices()
+  {
+    sorted.clear();
+    for (auto const &list : lists) sorted.insert(sorted.end(), list.begin(), list.end());
+    tbb::parallel_sort(sorted.begin(), sorted.end());
+    return sorted;
+  }
+
+  auto num_set() noexcept { return bits.num_set(); }
+
+  bool is_empty() noexcept { return bits.is_empty(); }
+};
+}// namespace famgraph
+
+#endif// __PROJ_FRONTIER_H__
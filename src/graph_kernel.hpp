@@ -1,12 +1,19 @@
 #ifndef __PROJ_GRAPH_KERNEL_H__
 #define __PROJ_GRAPH_KERNEL_H__
 
+#include <chrono>
 #include <utility>
 #include <memory>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
 #include <client_runtime.hpp>
 #include "graph_types.hpp"//TODO: move defs to here and delete this file.
 #include "vertex_table.hpp"
 #include "bitmap.hpp"
+#include "frontier.hpp"
+#include "edge_fetch.hpp"
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/expressions.hpp>
@@ -15,38 +22,220 @@ namespace famgraph {
 
 enum class Buffering { SINGLE = 1, DOUBLE = 2 };
 
+// --double-buffer is kept as shorthand for a two deep pipeline
+inline uint32_t get_pipeline_depth(boost::program_options::variables_map const &vm,
+  Buffering const b)
+{
+  auto const requested = vm.count("double-buffer")
+                           ? static_cast<uint32_t>(Buffering::DOUBLE)
+                           : vm["pipeline-depth"].as<uint32_t>();
+  auto const depth = std::max(requested, static_cast<uint32_t>(b));
+  if (depth > famgraph::MAX_PIPELINE_DEPTH) {
+    throw std::runtime_error("pipeline depth exceeds MAX_PIPELINE_DEPTH");
+  }
+  return depth;
+}
+
+// Edges per window. The window no longer has to hold the largest adjacency list:
+// lists that do not fit are streamed in chunks, so --window-edges caps the RDMA
+// memory per worker independently of the degree distribution. With compressed lists
+// a window must fit at least a few frames, and a frame must decode into the scratch
+// buffer, which is as large as a window.
+inline uint32_t get_edge_buf_size(boost::program_options::variables_map const &vm,
+  uint32_t const max_out_degree)
+{
+  uint64_t const by_degree =
+    static_cast<uint64_t>(vm["edgewindow"].as<uint32_t>()) * max_out_degree;
+  uint64_t const cap = vm["window-edges"].as<uint32_t>();
+  if (cap == 0) throw std::runtime_error("window-edges must be > 0");
+  uint64_t const floor = vm.count("compressed-index") ? famgraph::codec::FRAME_BYTES : 1;
+  return static_cast<uint32_t>(std::max(std::min(by_degree, cap), floor));
+}
+
+// Null unless --compressed-index is set.
+inline std::unique_ptr<uint64_t, famgraph::mmap_deleter> load_byte_index(
+  struct client_context &ctx,
+  uint32_t const num_vertices)
+{
+  auto const &vm = *ctx.vm;
+  if (!vm.count("compressed-index")) {
+    return std::unique_ptr<uint64_t, famgraph::mmap_deleter>(
+      nullptr, famgraph::mmap_deleter(0));
+  }
+  return famgraph::get_byte_index(vm["compressed-index"].as<std::string>(),
+    num_vertices,
+    vm.count("hp") ? true : false);
+}
+
+// Null unless --adj-cache-mb is set.
+inline std::unique_ptr<famgraph::adjacency_cache> make_adjacency_cache(
+  struct client_context &ctx)
+{
+  auto const &vm = *ctx.vm;
+  auto const budget_mb = vm["adj-cache-mb"].as<uint32_t>();
+  if (budget_mb == 0) return nullptr;
+  return std::make_unique<famgraph::adjacency_cache>(uint64_t{ budget_mb } << 20,
+    vm["adj-cache-min-degree"].as<uint32_t>(),
+    ctx.pd,
+    vm.count("hp") ? true : false,
+    ctx.stats);
+}
+
+// One registered gather request per window slot, null unless gathering is on.
+inline std::unique_ptr<gather_request, famgraph::RDMA_mmap_deleter>
+  make_gather_requests(struct client_context &ctx,
+    famgraph::fetch_config const &fetch,
+    size_t const n_windows)
+{
+  if (fetch.gather_bytes == 0) {
+    return std::unique_ptr<gather_request, famgraph::RDMA_mmap_deleter>(
+      nullptr, famgraph::RDMA_mmap_deleter(0, nullptr));
+  }
+  return famgraph::RDMA_mmap_unique<gather_request>(n_windows, ctx.pd, false);
+}
+
+// The registered edge windows, pipeline_depth slots of buf_size edges per worker.
+// With --numa-aware each worker's slots are placed on its node before registration
+// pins them. A huge page cannot be split between nodes, so --hp keeps one policy.
+inline std::unique_ptr<unsigned int, famgraph::RDMA_mmap_deleter> make_edge_windows(
+  struct client_context &ctx,
+  uint64_t const buf_size,
+  unsigned long const workers,
+  uint32_t const depth,
+  unsigned const access)
+{
+  bool const use_HP = ctx.vm->count("hp") ? true : false;
+  auto const *const numa = use_HP ? nullptr : ctx.numa.get();
+  return famgraph::RDMA_mmap_unique_filled<uint32_t>(buf_size * workers * depth,
+    ctx.pd,
+    use_HP,
+    [&](uint32_t *const windows) {
+      if (numa) numa->spread(windows, buf_size * workers * depth * 4, workers);
+    },
+    access);
+}
+
+// pipeline_depth slots per worker. With --numa-aware a worker's WR and SGE arrays are
+// allocated while preferring its node.
+inline std::vector<famgraph::window_slot> make_window_slots(struct client_context &ctx,
+  unsigned long const workers,
+  uint32_t const depth,
+  uint32_t const wr_window)
+{
+  std::vector<famgraph::window_slot> slots;
+  slots.reserve(workers * depth);
+  for (size_t w = 0; w < workers; ++w) {
+    auto add = [&] {
+      for (uint32_t d = 0; d < depth; ++d) slots.emplace_back(wr_window);
+    };
+    if (ctx.numa) {
+      ctx.numa->on_node(ctx.numa->node_of(w), add);
+    } else {
+      add();
+    }
+  }
+  return slots;
+}
+
 template<typename V> struct Generic_ctx
 {
   struct client_context *const context;
   uint32_t const num_vertices;
+  uint32_t const num_local;// vertices with an entry in p.second
   uint64_t const num_edges;
-  std::pair<std::unique_ptr<famgraph::vertex, famgraph::mmap_deleter>,
+  famgraph::index_table loaded;// its index moves to p.first
+  std::pair<std::unique_ptr<famgraph::compact_index>,
     std::unique_ptr<V, famgraph::mmap_deleter>>
     p;
   unsigned long const num_workers;
   uint32_t const max_out_degree;
   uint32_t const edge_buf_size;
+  uint32_t const pipeline_depth;
+  bool const use_cq_events;
+  famgraph::fetch_config const fetch;
+  std::unique_ptr<famgraph::adjacency_cache> const adj_cache;
+  std::unique_ptr<uint64_t, famgraph::mmap_deleter> const byte_index;
+  famgraph::edge_source const out_edges;
   std::unique_ptr<unsigned int, famgraph::RDMA_mmap_deleter> RDMA_window;
-  famgraph::Bitmap frontierA;
-  famgraph::Bitmap frontierB;
+  std::vector<famgraph::window_slot> windows;// pipeline_depth slots per worker
+  std::vector<std::vector<uint32_t>> decode_bufs;// per worker, for compressed lists
+  std::unique_ptr<gather_request, famgraph::RDMA_mmap_deleter> gather_requests;
+  famgraph::Frontier frontierA;
+  famgraph::Frontier frontierB;
 
-  Generic_ctx(struct client_context &ctx, Buffering const b)
-    : context{ &ctx }, num_vertices{ famgraph::get_num_verts(ctx.index_file) },
-      num_edges{ ctx.num_edges }, p{ famgraph::get_vertex_table<V>(ctx.index_file,
-                                    num_vertices,
-                                    ctx.vm->count("hp") ? true : false) },
+  // Kernels that keep part of their state elsewhere (see remote_state.hpp) pass
+  // t_num_local; the vertex table then covers only [0, t_num_local).
+  Generic_ctx(struct client_context &ctx,
+    Buffering const b,
+    uint32_t const t_num_local = std::numeric_limits<uint32_t>::max())
+    : context{ &ctx }, num_vertices{ ctx.app->num_vertices },
+      num_local{ std::min(t_num_local, num_vertices) }, num_edges{ ctx.num_edges },
+      loaded{ ctx.index_load.get() },
+      p{ std::move(loaded.index),
+        famgraph::mmap_unique<V>(num_local, ctx.vm->count("hp") ? true : false) },
       num_workers{ (*ctx.vm)["threads"].as<unsigned long>() },
-      max_out_degree{
-        famgraph::get_max_out_degree(p.first.get(), num_vertices, num_edges)
+      max_out_degree{ loaded.max_out_degree },
+      edge_buf_size{ famgraph::get_edge_buf_size(*ctx.vm, max_out_degree) },
+      pipeline_depth{ famgraph::get_pipeline_depth(*ctx.vm, b) },
+      use_cq_events{ ctx.vm->count("cq-events") ? true : false },
+      fetch{ famgraph::get_fetch_config(*ctx.vm, ctx.gather_bytes) },
+      adj_cache{ famgraph::make_adjacency_cache(ctx) },
+      byte_index{ famgraph::load_byte_index(ctx, num_vertices) },
+      out_edges{ p.first.get(),
+        num_vertices,
+        num_edges,
+        ctx.peer_addr,
+        ctx.peer_rkey,
+        adj_cache.get(),
+        byte_index.get(),
+        ctx.shards.size() > 1 ? &ctx.shards : nullptr },
+      RDMA_window{ famgraph::make_edge_windows(ctx,
+        edge_buf_size,
+        num_workers,
+        pipeline_depth,
+        // gather replies are written into the windows by the server
+        fetch.gather_bytes ? unsigned{ famgraph::IB_FLAGS | IBV_ACCESS_REMOTE_WRITE }
+                           : unsigned{ famgraph::IB_FLAGS }) },
+      windows{
+        famgraph::make_window_slots(ctx, num_workers, pipeline_depth, fetch.wr_window)
       },
-      edge_buf_size{ (*ctx.vm)["edgewindow"].as<uint32_t>() * max_out_degree },
-      RDMA_window{ famgraph::RDMA_mmap_unique<uint32_t>(
-        edge_buf_size * num_workers * static_cast<uint32_t>(b),
-        ctx.pd,
-        ctx.vm->count("HP")) },
+      decode_bufs(byte_index ? num_workers : 0, std::vector<uint32_t>(edge_buf_size)),
+      gather_requests{ famgraph::make_gather_requests(ctx, fetch, windows.size()) },
       frontierA{ num_vertices }, frontierB{ num_vertices }
   {
     ctx.heap_mr = this->RDMA_window.get_deleter().mr;
+    // rounds split the vertex range in ID order, so worker w mostly owns block w
+    if (ctx.numa && !ctx.vm->count("hp")) {
+      ctx.numa->spread(p.second.get(), uint64_t{ num_local } * sizeof(V), num_workers);
+    }
+    for (size_t i = 0; i < windows.size(); ++i) {
+      windows[i].edge_buf = RDMA_window.get() + i * edge_buf_size;
+      if (gather_requests) {
+        windows[i].request = gather_requests.get() + i;
+        windows[i].request_lkey = gather_requests.get_deleter().mr->lkey;
+      }
+    }
+    ctx.stats.pipeline_depth = pipeline_depth;
+    BOOST_LOG_TRIVIAL(info) << "pipeline depth: " << pipeline_depth;
+    BOOST_LOG_TRIVIAL(info) << "edge window: " << edge_buf_size << " edges ("
+                            << max_out_degree << " max out degree), "
+                            << (static_cast<uint64_t>(edge_buf_size) * sizeof(uint32_t)
+                                 * num_workers * pipeline_depth >> 20)
+                            << " MiB registered";
+    BOOST_LOG_TRIVIAL(info) << "wr window: " << fetch.wr_window
+                            << " coalesce: " << fetch.coalesce
+                            << " coalesce gap: " << fetch.coalesce_gap
+                            << " coalesce bytes: " << fetch.coalesce_bytes
+                            << " signal interval: " << fetch.signal_interval;
+    if (fetch.gather_bytes) {
+      BOOST_LOG_TRIVIAL(info) << "gather: windows of at least " << fetch.gather_min_wrs
+                              << " WR's, up to " << fetch.gather_bytes << " bytes";
+    }
+    if (byte_index) BOOST_LOG_TRIVIAL(info) << "compressed adjacency lists";
+    if (adj_cache) {
+      BOOST_LOG_TRIVIAL(info) << "adjacency cache: "
+                              << (*ctx.vm)["adj-cache-mb"].as<uint32_t>() << " MiB";
+    }
     // bool const use_HP = ctx.vm->count("hp") ? true : false;
     // this->index = std::move(p.first);
     // this->vertex_table = std::move(p.second);
@@ -59,9 +248,13 @@ template<typename V> struct Generic_ctx
 
 template<class KERNEL> void run_kernel(struct client_context &ctx)
 {
+  ctx.wait_for_connections();
   auto kernel = KERNEL{ ctx };
   tbb::global_control c(
     tbb::global_control::max_allowed_parallelism, kernel.c.num_workers);
+  std::chrono::duration<double> const startup =
+    std::chrono::steady_clock::now() - ctx.started;
+  BOOST_LOG_TRIVIAL(info) << "Time to first round(s): " << startup.count();
   tbb::tick_count t0 = tbb::tick_count::now();
   kernel();
   tbb::tick_count t1 = tbb::tick_count::now();
@@ -0,0 +1,45 @@
+#ifndef __PROJ_INDEX_TABLE_H__
+#define __PROJ_INDEX_TABLE_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "compact_index.hpp"
+#include "graph_types.hpp"
+#include "mmap_util.hpp"
+
+struct client_context;
+struct named_region;
+
+namespace famgraph {
+// A loaded .idx file: the edge offset of every vertex, compacted, and the largest
+// out-degree.
+struct index_table
+{
+  std::unique_ptr<famgraph::compact_index> index;
+  uint32_t max_out_degree;
+};
+
+// Reads the num_vertices offsets of an .idx file with large preads spread over the
+// TBB workers and compacts them, finding the largest out-degree of the graph's
+// num_edges edges in the same pass. The full 8 byte offsets are never held at once.
+index_table load_index(std::string const &file,
+  uint32_t const num_vertices,
+  uint64_t const num_edges,
+  bool const use_HP);
+
+// Reads the index a memory server registered as region, with RDMA READs spread over
+// the data QPs to that server, instead of from a file. The server's catalog supplies
+// num_vertices and max_out_degree, so no degree is looked for. Call once the data QPs
+// are connected and before any kernel uses them.
+index_table fetch_index(client_context &ctx,
+  uint32_t const server,
+  named_region const &region,
+  uint32_t const num_vertices,
+  uint64_t const num_edges,
+  uint32_t const max_out_degree,
+  bool const use_HP);
+}// namespace famgraph
+
+#endif// __PROJ_INDEX_TABLE_H__
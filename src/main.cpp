@@ -24,10 +24,23 @@ int main(int argc, char *argv[])
     desc.add_options()("help,h", "Help screen")("verbose,v", "verbose")(
       "mode,m", po::value<std::string>(), "client or server mode")("server-addr,a",
       po::value<std::string>()->default_value("192.168.12.2"),
-      "Server's IPoIB addr")("port,p",
+      "Server's IPoIB addr; a client takes a list host[:port],... in shard order")(
+      "port,p",
       po::value<std::string>()->default_value("12345"),
-      "server port")("indexfile,i", po::value<std::string>(), "path to .idx file")(
-      "edgefile,e", po::value<std::string>(), "path to .adj file")("kernel,k",
+      "server port")("indexfile,i",
+      po::value<std::string>(),
+      "path to .idx file (a client fetches it from a server that serves it)")(
+      "edgefile,e", po::value<std::string>(), "path to .adj file")(
+      "weightfile",
+      po::value<std::string>(),
+      "path to a file of one float weight per edge, served with the edges")(
+      "local-index", "client reads --indexfile even if a server serves the index")(
+      "in-edgefile",
+      po::value<std::string>(),
+      "path to the transposed .adj file (enables pull-based BFS)")(
+      "in-indexfile",
+      po::value<std::string>(),
+      "path to the transposed .idx file (enables pull-based BFS)")("kernel,k",
       po::value<std::string>()->default_value("print_graph"),
       "kernel to run")("ofile,o",
       po::value<std::string>()->default_value("/home/username/graphs/kernel-out.txt"),
@@ -38,10 +51,85 @@ int main(int argc, char *argv[])
       "kcore-k", po::value<uint32_t>()->default_value(100), "The k in k-core")(
       "delta", po::value<uint32_t>()->default_value(25), "delta step divisor for MIS")(
       "start-vertex", po::value<uint32_t>()->default_value(1), "start vertex for bfs")(
-      "hp", "use huge pages")("double-buffer", "use double buffering")("edgewindow",
+      "hp", "use huge pages")(
+      "double-buffer", "use double buffering (--pipeline-depth 2)")(
+      "pipeline-depth",
+      po::value<uint32_t>()->default_value(1),
+      "edge windows each worker keeps in flight")("edgewindow",
       po::value<uint32_t>()->default_value(1),
       "how many times larger than max outdegree the edgewindow should be")(
-      "no-numa-bind", "don't do numa bind");
+      "window-edges",
+      po::value<uint32_t>()->default_value(1 << 20),
+      "cap on edges per window; larger adjacency lists are fetched in chunks")(
+      "no-numa-bind", "don't do numa bind")(
+      "rdma-heap-mb",
+      po::value<uint32_t>()->default_value(0),
+      "register one heap of this many MiB for the client's RDMA buffers, 0 disables")(
+      "qps-per-worker",
+      po::value<unsigned long>()->default_value(1),
+      "data QPs per worker and server; a worker's windows rotate over them")(
+      "numa-aware",
+      "pin workers by the HCA first and place their windows and vertex blocks locally")(
+      "no-edge-balance", "split rounds by vertex ID instead of by active edge volume")(
+      "parts-per-worker",
+      po::value<uint32_t>()->default_value(8),
+      "edge-balanced parts per worker per round")("adj-cache-mb",
+      po::value<uint32_t>()->default_value(0),
+      "client memory for caching hot adjacency lists, 0 disables")(
+      "adj-cache-min-degree",
+      po::value<uint32_t>()->default_value(256),
+      "smallest degree whose adjacency list may be cached")("compressed-index",
+      po::value<std::string>(),
+      ".cidx of a compressed graph; the server must serve the matching .cadj")("gather",
+      "let the server gather batches of short scattered adjacency lists")(
+      "gather-min-wrs",
+      po::value<uint32_t>(),
+      "fewest READ WR's a window must need before it is gathered instead (default 8)")(
+      "gather-max-extent",
+      po::value<uint32_t>(),
+      "largest mean bytes per WR for which a window is gathered (default 1024)")(
+      "shards",
+      po::value<uint32_t>()->default_value(1),
+      "memory servers the edge array is split across (server, needs --indexfile)")(
+      "shard",
+      po::value<uint32_t>()->default_value(0),
+      "which vertex range of the edge array this server holds, from 0")(
+      "serve-graph",
+      po::value<std::string>(),
+      "more graphs the server preloads, as NAME=ADJ[:IN_ADJ],...")(
+      "graph",
+      po::value<std::string>(),
+      "name of the served graph to run on (default: the server's first)")(
+      "load-threads",
+      po::value<uint32_t>()->default_value(0),
+      "threads reading the edge file on the server, 0 for all cores")(
+      "direct-io", "server reads the edge file with O_DIRECT")(
+      "map-shared", "server registers the edge file's page cache instead of a copy")(
+      "remote-vertex-state",
+      po::value<uint32_t>()->default_value(0),
+      "percent of the bfs vertex table (its highest IDs) kept on memory server 0")(
+      "gather-threads",
+      po::value<uint32_t>()->default_value(0),
+      "server threads answering gather requests, each polling busily; 0 disables")(
+      "gather-bytes",
+      po::value<uint32_t>()->default_value(1 << 20),
+      "largest gather reply the server builds")(
+      "cq-events",
+      "idle workers sleep on their CQ's completion channel instead of busy polling")(
+      "wr-window",
+      po::value<uint32_t>(),
+      "max WR's chained into one edge window (default OPT_WR_WINDOW)")("coalesce",
+      po::value<bool>(),
+      "merge the reads of neighbouring active vertices (default VERTEX_COALESCING)")(
+      "coalesce-gap",
+      po::value<uint32_t>(),
+      "inactive vertices a WR may read through (default OPT_COALESCE_GAP)")(
+      "coalesce-bytes",
+      po::value<uint32_t>(),
+      "inactive adjacency bytes a WR may read through (default OPT_COALESCE_BYTES)")(
+      "signal-interval",
+      po::value<uint32_t>(),
+      "signal every n'th WR of a chain (default --wr-window)");
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
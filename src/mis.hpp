@@ -51,8 +51,6 @@ public:
     auto const num_edges = c.num_edges;
     auto const idx = c.p.first.get();
     auto vtable = c.p.second.get();
-    auto RDMA_area = c.RDMA_window.get();
-    auto const edge_buf_size = c.edge_buf_size;
     auto *frontier = &c.frontierA;
     auto *next_frontier = &c.frontierB;
 
@@ -64,16 +62,23 @@ public:
     tbb::combinable<uint32_t> n_decided;
     tbb::combinable<uint32_t> next_frontier_size;
 
-    auto pull = [&](uint32_t const v, uint32_t *const edges, uint32_t const n) noexcept
+    // verdict so far on the oversized vertex each worker is streaming in chunks
+    tbb::enumerable_thread_specific<mis::MatchFlag> partial_flag;
+
+    auto pull = [&](uint32_t const v,
+                  uint32_t *const edges,
+                  uint32_t const n,
+                  famgraph::v_interval const &part) noexcept
     {
       if (vtable[v].flag == mis::MatchFlag::OUT) {
         assert(1 == 0);
         return;// Can this happen? ... No
       }
 
-      mis::MatchFlag v_flag = mis::MatchFlag::IN;// Assume we are in
+      auto &v_flag = partial_flag.local();
+      if (part.start == 0) v_flag = mis::MatchFlag::IN;// Assume we are in
 
-      for (uint32_t i = 0; i < n; ++i) {
+      for (uint32_t i = 0; i < n && v_flag != mis::MatchFlag::OUT; ++i) {
         uint32_t w = edges[i];
         if (w < v) {// w has priority, what should we do?
           switch (vtable[w].flag) {
@@ -86,10 +91,11 @@ public:
           case mis::MatchFlag::OUT:
             break;
           }
-          if (v_flag == mis::MatchFlag::OUT) { break; }
         }
       }
 
+      if (part.end < part.d) return;// more chunks to come
+
       if (v_flag == mis::MatchFlag::UNDECIDED) {
         next_frontier->set_bit(v);
         ++next_frontier_size.local();
@@ -124,8 +130,7 @@ public:
       end = std::min(total_verts, end + delta - front_size);
       if (start < end) {// break new ground
         tbb::blocked_range<uint32_t> const range(start, end);
-        famgraph::single_buffer::for_each_range(
-          range, RDMA_area, edge_buf_size, idx, c.context, pull);
+        famgraph::single_buffer::for_each_range(range, c, pull);
       }
       start = end;
       undecided -= n_decided.combine(std::plus<uint32_t>{});
@@ -5,9 +5,20 @@
 #include <sys/mman.h>
 #include <boost/log/trivial.hpp>
 #include <memory>
+#include <cstring>
 #include <stdexcept>
+#include <type_traits>
 #include <boost/align/align_up.hpp>
 
+#include "rdma_arena.hpp"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
 namespace famgraph {
 constexpr auto PROT_RW = PROT_READ | PROT_WRITE;
 constexpr auto MAP_ALLOC = MAP_PRIVATE | MAP_ANONYMOUS;
@@ -17,27 +28,63 @@ struct RDMA_mmap_deleter
 {
   std::size_t const m_size;
   struct ibv_mr *const mr;
+  rdma_arena *const arena;// set if the memory came from the RDMA heap
 
-  RDMA_mmap_deleter(std::size_t size, struct ibv_mr *t_mr) : m_size{ size }, mr{ t_mr } {}
+  RDMA_mmap_deleter(std::size_t size, struct ibv_mr *t_mr, rdma_arena *t_arena = nullptr)
+    : m_size{ size }, mr{ t_mr }, arena{ t_arena }
+  {}
 
+  // Unmaps the registered range, which starts before ptr when ptr points into a
+  // file mapping. Memory from the RDMA heap goes back to it.
   void operator()(void *ptr) const
   {
+    if (arena) {
+      arena->deallocate(ptr, m_size);
+      return;
+    }
+    void *const addr = mr->addr;
     if (ibv_dereg_mr(mr)) { BOOST_LOG_TRIVIAL(fatal) << "error unmapping RDMA buffer"; }
-    munmap(ptr, m_size);
+    munmap(addr, m_size);
   }
 };
 
-template<typename T> auto RDMA_mmap_unique(uint64_t array_size, ibv_pd *pd, bool use_HP)
+// Like RDMA_mmap_unique, but fill(ptr) runs before the memory is registered, so the
+// pages are first touched, and placed, by whichever threads fill writes them from.
+// With an RDMA heap installed for pd, the memory is carved from the heap instead
+// (zeroed, as a fresh mapping would be) unless it asks for huge pages, and fill runs
+// on memory that is already registered.
+template<typename T, typename F>
+auto RDMA_mmap_unique_filled(uint64_t array_size,
+  ibv_pd *pd,
+  bool use_HP,
+  F &&fill,
+  unsigned access = IB_FLAGS)
 {
   auto constexpr HP_align = 1 << 30;// 1 GB huge pages
   auto const HP_FLAGS = use_HP ? MAP_HUGETLB : 0;
   auto const req_size = sizeof(T) * array_size;
+
+  if (auto *const heap = rdma_arena::current();
+      heap && !use_HP && heap->mr()->pd == pd
+      && (access & ~heap->access()) == 0 && req_size > 0) {
+    if (auto *const ptr = heap->allocate(req_size)) {
+      std::memset(ptr, 0, req_size);
+      fill(static_cast<T *>(ptr));
+      return std::unique_ptr<T, RDMA_mmap_deleter>(
+        static_cast<T *>(ptr), RDMA_mmap_deleter(req_size, heap->mr(), heap));
+    }
+    BOOST_LOG_TRIVIAL(info) << req_size << " bytes do not fit the RDMA heap ("
+                            << heap->used() << " of " << heap->size()
+                            << " used), registering them separately";
+  }
   auto const aligned_size =
     use_HP ? boost::alignment::align_up(req_size, HP_align) : req_size;
 
   BOOST_LOG_TRIVIAL(debug) << "aligned size: " << aligned_size << " use_HP: " << use_HP;
-  if (auto ptr = mmap(0, aligned_size, PROT_RW, MAP_ALLOC | HP_FLAGS, -1, 0)) {
-    struct ibv_mr *mr = ibv_reg_mr(pd, ptr, aligned_size, IB_FLAGS);
+  if (auto ptr = mmap(0, aligned_size, PROT_RW, MAP_ALLOC | HP_FLAGS, -1, 0);
+      ptr != MAP_FAILED) {
+    fill(static_cast<T *>(ptr));
+    struct ibv_mr *mr = ibv_reg_mr(pd, ptr, aligned_size, access);
     if (!mr) {
       BOOST_LOG_TRIVIAL(fatal) << "ibv_reg_mr failed";
       throw std::runtime_error("ibv_reg_mr failed");
@@ -50,6 +97,15 @@ template<typename T> auto RDMA_mmap_unique(uint64_t array_size, ibv_pd *pd, bool
   throw std::bad_alloc();
 }
 
+template<typename T>
+auto RDMA_mmap_unique(uint64_t array_size,
+  ibv_pd *pd,
+  bool use_HP,
+  unsigned access = IB_FLAGS)
+{
+  return RDMA_mmap_unique_filled<T>(array_size, pd, use_HP, [](T *) {}, access);
+}
+
 class mmap_deleter
 {
   std::size_t m_size;
@@ -71,8 +127,15 @@ template<typename T> auto mmap_unique(uint64_t const array_size, bool const use_
   BOOST_LOG_TRIVIAL(debug) << "nonRDMA aligned size: " << aligned_size
                            << " use_HP: " << use_HP;
   if (auto ptr = mmap(0, aligned_size, PROT_RW, MAP_ALLOC | HP_FLAGS, -1, 0)) {
-    for (uint64_t i = 0; i < array_size; ++i) {
-      (void)new (static_cast<T *>(ptr) + i) T{};// T must be default constructable
+    // fresh anonymous pages are already zero, which is T{} for trivial types; others
+    // are constructed in parallel, which also spreads the first touch across nodes
+    if constexpr (!std::is_trivially_default_constructible_v<T>) {
+      tbb::parallel_for(tbb::blocked_range<uint64_t>(0, array_size),
+        [ptr](tbb::blocked_range<uint64_t> const &range) {
+          for (uint64_t i = range.begin(); i < range.end(); ++i) {
+            (void)new (static_cast<T *>(ptr) + i) T{};// T must be default constructable
+          }
+        });
     }
     auto del = mmap_deleter(aligned_size);
     return std::unique_ptr<T, mmap_deleter>(static_cast<T *>(ptr), del);
@@ -0,0 +1,116 @@
+#include "numa_placement.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include <numa.h>
+#include <numaif.h>
+#include <rdma/rdma_cma.h>
+
+#include <boost/log/trivial.hpp>
+
+namespace {
+// The node of the first RDMA device, which is the one rc_client_loop ends up on. -1
+// if sysfs does not know.
+int hca_numa_node()
+{
+  int n = 0;
+  struct ibv_context **const devices = rdma_get_devices(&n);
+  if (!devices) return -1;
+  int node = -1;
+  if (n > 0) {
+    std::ifstream f(std::string("/sys/class/infiniband/")
+                    + ibv_get_device_name(devices[0]->device) + "/device/numa_node");
+    f >> node;
+  }
+  rdma_free_devices(devices);
+  return node;
+}
+}// namespace
+
+famgraph::numa_placement::numa_placement()
+{
+  if (numa_available() == -1) throw std::runtime_error("numa is not supported");
+  num_nodes = std::max(numa_num_configured_nodes(), 1);
+  hca_node = std::max(hca_numa_node(), 0);
+
+  auto *const allowed = numa_allocate_cpumask();
+  if (numa_sched_getaffinity(0, allowed) < 0) numa_bitmask_setall(allowed);
+  for (int i = 0; i < num_nodes; ++i) {
+    int const node = (hca_node + i) % num_nodes;
+    for (int cpu = 0; cpu < numa_num_configured_cpus(); ++cpu) {
+      if (numa_node_of_cpu(cpu) != node) continue;
+      if (!numa_bitmask_isbitset(allowed, static_cast<unsigned>(cpu))) continue;
+      cpus.push_back(cpu);
+      nodes.push_back(node);
+    }
+  }
+  numa_bitmask_free(allowed);
+  if (cpus.empty()) throw std::runtime_error("no CPUs to place workers on");
+
+  BOOST_LOG_TRIVIAL(info) << "numa aware: HCA on node " << hca_node << " of "
+                          << num_nodes << ", " << cpus.size() << " CPUs, HCA's first";
+}
+
+void famgraph::numa_placement::spread(void *const addr,
+  size_t const len,
+  size_t const workers) const noexcept
+{
+  if (num_nodes == 1 || workers == 0) return;
+  auto const page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  auto const base = reinterpret_cast<uintptr_t>(addr);
+  auto const block = len / workers;
+  for (size_t w = 0; w < workers; ++w) {
+    auto const begin = (base + w * block + page - 1) / page * page;
+    auto const end = (base + (w + 1 == workers ? len : (w + 1) * block)) / page * page;
+    if (end <= begin) continue;
+    unsigned long mask = 1UL << node_of(w);
+    if (mbind(reinterpret_cast<void *>(begin),
+          end - begin,
+          MPOL_PREFERRED,
+          &mask,
+          sizeof(mask) * 8,
+          MPOL_MF_MOVE)) {
+      BOOST_LOG_TRIVIAL(debug) << "mbind() failed for worker " << w;
+    }
+  }
+}
+
+famgraph::numa_placement::policy famgraph::numa_placement::prefer(
+  int const node) const noexcept
+{
+  policy saved{ MPOL_DEFAULT, 0 };
+  if (get_mempolicy(&saved.mode, &saved.mask, sizeof(saved.mask) * 8, nullptr, 0)) {
+    saved = { MPOL_DEFAULT, 0 };
+  }
+  numa_set_preferred(node);
+  return saved;
+}
+
+void famgraph::numa_placement::restore(policy const &p) const noexcept
+{
+  set_mempolicy(p.mode, p.mode == MPOL_DEFAULT ? nullptr : &p.mask, sizeof(p.mask) * 8);
+}
+
+famgraph::worker_pinning::worker_pinning(numa_placement const &t_place)
+  : tbb::task_scheduler_observer(), place{ t_place }
+{
+  observe(true);
+}
+
+void famgraph::worker_pinning::on_scheduler_entry(bool)
+{
+  auto const idx = tbb::this_task_arena::current_thread_index();
+  if (idx < 0) return;
+  auto *const cpu = numa_allocate_cpumask();
+  numa_bitmask_setbit(cpu, static_cast<unsigned>(place.cpu_of(static_cast<size_t>(idx))));
+  if (numa_sched_setaffinity(0, cpu)) {
+    BOOST_LOG_TRIVIAL(warning) << "could not pin worker " << idx;
+  }
+  numa_bitmask_free(cpu);
+  numa_set_localalloc();
+}
@@ -0,0 +1,74 @@
+#ifndef __PROJ_NUMA_PLACEMENT_H__
+#define __PROJ_NUMA_PLACEMENT_H__
+
+#include <cstddef>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
+namespace famgraph {
+// Where the workers run with --numa-aware. Worker w (its TBB thread index) is pinned
+// to cpus[w % cpus.size()]. The CPUs of the node closest to the HCA come first, so up
+// to that node's core count every worker shares the HCA's socket; further workers
+// spill over to the other nodes in order.
+class numa_placement
+{
+  std::vector<int> cpus;
+  std::vector<int> nodes;// node of each of cpus
+  int hca_node{ 0 };
+  int num_nodes{ 1 };
+
+public:
+  numa_placement();
+
+  int cpu_of(size_t const worker) const noexcept { return cpus[worker % cpus.size()]; }
+  int node_of(size_t const worker) const noexcept
+  {
+    return nodes[worker % nodes.size()];
+  }
+  int hca() const noexcept { return hca_node; }
+  int node_count() const noexcept { return num_nodes; }
+
+  // Places [addr, addr + len), cut into `workers` equal blocks, so block w lives on
+  // worker w's node. Pages already touched are migrated. Whole pages only: a page
+  // straddling two blocks stays with the first.
+  void spread(void *addr, size_t len, size_t workers) const noexcept;
+
+  // Runs f with the calling thread's allocations preferring node.
+  template<typename F> void on_node(int const node, F const &f) const
+  {
+    auto const saved = prefer(node);
+    f();
+    restore(saved);
+  }
+
+private:
+  struct policy
+  {
+    int mode;
+    unsigned long mask;
+  };
+  policy prefer(int node) const noexcept;
+  void restore(policy const &p) const noexcept;
+};
+
+// Pins every thread that joins the TBB arena to the CPU of its thread index, and
+// makes its allocations node local.
+class worker_pinning : public tbb::task_scheduler_observer
+{
+  numa_placement const &place;
+
+public:
+  explicit worker_pinning(numa_placement const &t_place);
+  ~worker_pinning() override { observe(false); }
+
+  void on_scheduler_entry(bool) override;
+};
+}// namespace famgraph
+
+#endif// __PROJ_NUMA_PLACEMENT_H__
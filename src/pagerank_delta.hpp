@@ -87,13 +87,18 @@ public:
 
     frontier->set_all();
 
-    auto pagerank_push = [&](
-      uint32_t const v, uint32_t *const edges, uint32_t const n) noexcept
+    // Chunk aware: the share is split over the full degree, and delta is only spent
+    // once the last chunk of the adjacency list has been pushed.
+    auto pagerank_push = [&](uint32_t const v,
+                           uint32_t *const edges,
+                           uint32_t const n,
+                           famgraph::v_interval const &part) noexcept
     {
       if (n > 0) {// unneeded?
         float const my_delta = vtable[v].delta;
-        vtable[v].delta = 0.0;// used all of our sauce
-        float const my_val = my_delta * pagerank_delta::alpha / static_cast<float>(n);
+        if (part.end == part.d) vtable[v].delta = 0.0;// used all of our sauce
+        float const my_val =
+          my_delta * pagerank_delta::alpha / static_cast<float>(part.d);
         for (uint32_t i = 0; i < n; ++i) {
           uint32_t w = edges[i];
           vtable[w].update_add_atomic(my_val);
@@ -0,0 +1,129 @@
+#include "rdma_arena.hpp"
+
+#include <stdexcept>
+
+#include <sys/mman.h>
+
+#include <boost/align/align_up.hpp>
+#include <boost/log/trivial.hpp>
+
+std::atomic<famgraph::rdma_arena *> famgraph::rdma_arena::installed{ nullptr };
+
+namespace {
+// The size class holding n bytes: class c holds MIN_SMALL << c.
+size_t size_class(size_t const n) noexcept
+{
+  size_t c = 0;
+  while ((famgraph::rdma_arena::MIN_SMALL << c) < n) ++c;
+  return c;
+}
+}// namespace
+
+famgraph::rdma_arena::rdma_arena(struct ibv_pd *const pd,
+  size_t const t_bytes,
+  bool const use_HP,
+  unsigned const access)
+  : bytes{ use_HP ? boost::alignment::align_up(t_bytes, size_t{ 1 } << 30)
+                  : boost::alignment::align_up(t_bytes, PAGE) },
+    access_flags{ access }
+{
+  auto *const ptr = mmap(0,
+    bytes,
+    PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | (use_HP ? MAP_HUGETLB : 0),
+    -1,
+    0);
+  if (ptr == MAP_FAILED) throw std::bad_alloc();
+  base = static_cast<char *>(ptr);
+  region = ibv_reg_mr(pd, base, bytes, access);
+  if (!region) {
+    munmap(base, bytes);
+    throw std::runtime_error("ibv_reg_mr failed for the RDMA heap");
+  }
+  extents.emplace(0, bytes);
+  BOOST_LOG_TRIVIAL(info) << "RDMA heap: " << (bytes >> 20) << " MiB, lkey "
+                          << region->lkey;
+}
+
+famgraph::rdma_arena::~rdma_arena()
+{
+  if (current() == this) install(nullptr);
+  if (ibv_dereg_mr(region)) BOOST_LOG_TRIVIAL(fatal) << "error unmapping RDMA heap";
+  munmap(base, bytes);
+}
+
+void *famgraph::rdma_arena::take_extent(size_t const len)
+{
+  std::lock_guard<std::mutex> guard{ extents_lock };
+  for (auto it = extents.begin(); it != extents.end(); ++it) {
+    if (it->second < len) continue;
+    auto const offset = it->first;
+    auto const rest = it->second - len;
+    extents.erase(it);
+    if (rest) extents.emplace(offset + len, rest);
+    return base + offset;
+  }
+  return nullptr;
+}
+
+void famgraph::rdma_arena::give_extent(size_t offset, size_t len)
+{
+  std::lock_guard<std::mutex> guard{ extents_lock };
+  auto next = extents.lower_bound(offset);
+  if (next != extents.end() && offset + len == next->first) {
+    len += next->second;
+    next = extents.erase(next);
+  }
+  if (next != extents.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += len;
+      return;
+    }
+  }
+  extents.emplace_hint(next, offset, len);
+}
+
+void *famgraph::rdma_arena::allocate(size_t const n)
+{
+  if (n > MAX_SMALL) {
+    auto const len = boost::alignment::align_up(n, PAGE);
+    auto *const p = take_extent(len);
+    if (p) in_use.fetch_add(len, std::memory_order_relaxed);
+    return p;
+  }
+
+  auto const c = size_class(n);
+  auto const block = MIN_SMALL << c;
+  auto &head = caches.local().free[c];
+  if (!head) {
+    // refill: carve a slab into blocks of this class
+    auto *const slab = static_cast<char *>(take_extent(SLAB));
+    if (!slab) return nullptr;
+    for (size_t off = SLAB; off >= block; off -= block) {
+      auto *const b = slab + off - block;
+      *reinterpret_cast<void **>(b) = head;
+      head = b;
+    }
+  }
+  auto *const p = head;
+  head = *static_cast<void **>(p);
+  in_use.fetch_add(block, std::memory_order_relaxed);
+  return p;
+}
+
+void famgraph::rdma_arena::deallocate(void *const p, size_t const n) noexcept
+{
+  if (!p) return;
+  if (n > MAX_SMALL) {
+    auto const len = boost::alignment::align_up(n, PAGE);
+    give_extent(static_cast<size_t>(static_cast<char *>(p) - base), len);
+    in_use.fetch_sub(len, std::memory_order_relaxed);
+    return;
+  }
+  auto const c = size_class(n);
+  auto &head = caches.local().free[c];
+  *static_cast<void **>(p) = head;
+  head = p;
+  in_use.fetch_sub(MIN_SMALL << c, std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+#ifndef __PROJ_RDMA_ARENA_H__
+#define __PROJ_RDMA_ARENA_H__
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include <infiniband/verbs.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
+namespace famgraph {
+// One large region, registered once, that registered buffers are carved from, so
+// they share a single lkey and cost no ibv_reg_mr() each. Requests up to
+// MAX_SMALL bytes come from per-thread free lists of power-of-two size classes,
+// refilled a slab at a time; larger ones are taken first fit from the free extents
+// of the region, page aligned. Small blocks are kept by the thread that frees them
+// and are never returned to the extents.
+class rdma_arena
+{
+public:
+  static constexpr size_t MIN_SMALL = 64;
+  static constexpr size_t MAX_SMALL = size_t{ 1 } << 20;
+  static constexpr size_t N_CLASSES = 15;// 64 B .. 1 MiB
+  static constexpr size_t SLAB = size_t{ 1 } << 20;
+  static constexpr size_t PAGE = 4096;
+
+private:
+  struct thread_cache
+  {
+    std::array<void *, N_CLASSES> free{};// intrusive lists, next pointer in the block
+  };
+
+  char *base;
+  size_t const bytes;
+  unsigned const access_flags;
+  struct ibv_mr *region;
+  std::mutex extents_lock;
+  std::map<size_t, size_t> extents;// free [offset, offset + length), coalesced
+  tbb::enumerable_thread_specific<thread_cache> caches;
+  std::atomic<size_t> in_use{ 0 };
+
+  static std::atomic<rdma_arena *> installed;
+
+  void *take_extent(size_t len);
+  void give_extent(size_t offset, size_t len);
+
+public:
+  // Maps and registers bytes with access; huge pages if use_HP.
+  rdma_arena(struct ibv_pd *pd, size_t bytes, bool use_HP, unsigned access);
+  ~rdma_arena();
+  rdma_arena(rdma_arena const &) = delete;
+  rdma_arena &operator=(rdma_arena const &) = delete;
+
+  // n bytes, at least 64 byte aligned, or nullptr if the arena is exhausted. The
+  // memory is not zeroed.
+  void *allocate(size_t n);
+  // p must have come from allocate(n).
+  void deallocate(void *p, size_t n) noexcept;
+
+  struct ibv_mr *mr() const noexcept { return region; }
+  unsigned access() const noexcept { return access_flags; }
+  size_t size() const noexcept { return bytes; }
+  size_t used() const noexcept { return in_use.load(std::memory_order_relaxed); }
+
+  // The arena RDMA_mmap_unique allocates from, if any.
+  static rdma_arena *current() noexcept
+  {
+    return installed.load(std::memory_order_acquire);
+  }
+  static void install(rdma_arena *a) noexcept
+  {
+    installed.store(a, std::memory_order_release);
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_RDMA_ARENA_H__
@@ -0,0 +1,185 @@
+#ifndef __PROJ_REMOTE_STATE_H__
+#define __PROJ_REMOTE_STATE_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
+#include <boost/log/trivial.hpp>
+#include <client_runtime.hpp>
+
+#include "communication_runtime.hpp"
+#include "edgemap.hpp"// WR, post_all
+#include "mmap_util.hpp"
+
+namespace famgraph {
+// How much of a vertex table stays in client memory. With --remote-vertex-state PCT
+// the highest PCT percent of the vertex IDs keep their state on memory server 0;
+// the low IDs, which hold the hubs of most of our inputs, stay local.
+inline uint32_t get_num_local(boost::program_options::variables_map const &vm,
+  uint32_t const num_vertices)
+{
+  uint64_t const pct = vm["remote-vertex-state"].as<uint32_t>();
+  return static_cast<uint32_t>(uint64_t{ num_vertices } * (100 - pct) / 100);
+}
+
+// Values of type T for vertices [first, first + count), held in a region of memory
+// server 0 that is allocated at startup. Workers put() updates into a per-thread
+// buffer; flush() combines them between rounds, so each vertex is written once and
+// runs of neighbouring vertices share one RDMA WRITE. All transfers go through the
+// client's state QP and a registered staging buffer, and only the thread running the
+// kernel flushes or reads.
+template<typename T> class remote_vertex_state
+{
+public:
+  // The most values one transfer carries; read() in chunks of this many to bound the
+  // client memory a read-back takes.
+  static constexpr uint32_t STAGING_ENTRIES = 1 << 16;
+
+private:
+  uint32_t const first;
+  uint32_t const count;
+  std::pair<uint64_t, uint32_t> const region;// remote address and rkey
+  struct rdma_cm_id *const id;
+  famgraph::completion_ring &ring;
+  uint32_t const max_wrs;
+  uint32_t const signal_interval;
+  bool const use_events;
+  std::unique_ptr<T, famgraph::RDMA_mmap_deleter> staging;
+  tbb::enumerable_thread_specific<std::vector<std::pair<uint32_t, T>>> pending;
+  std::vector<std::pair<uint32_t, T>> merged;
+  std::vector<WR> WRs;
+
+  uint64_t puts{ 0 };
+  uint64_t writes{ 0 };
+  uint64_t write_wrs{ 0 };
+  uint64_t read_bytes{ 0 };
+
+  // Transfers the WR's built so far and waits for them.
+  void post_and_wait()
+  {
+    if (WRs.empty()) return;
+    auto const seq = famgraph::post_all(WRs, id->qp, signal_interval, ring);
+    famgraph::wait_for_completion(id, ring, seq, use_events);
+    WRs.clear();
+  }
+
+  void add_wr(ibv_wr_opcode const opcode, uint32_t const v, uint32_t const n, T *buf)
+  {
+    WRs.emplace_back();
+    auto &wr = WRs.back().wr;
+    auto &sge = WRs.back().sge;
+    memset(&wr, 0, sizeof(wr));
+    wr.opcode = opcode;
+    wr.wr.rdma.remote_addr = region.first + uint64_t{ v - first } * sizeof(T);
+    wr.wr.rdma.rkey = region.second;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    sge.addr = reinterpret_cast<uintptr_t>(buf);
+    sge.length = n * static_cast<uint32_t>(sizeof(T));
+    sge.lkey = staging.get_deleter().mr->lkey;
+  }
+
+public:
+  remote_vertex_state(struct client_context &ctx,
+    uint32_t const t_first,
+    uint32_t const t_count,
+    famgraph::fetch_config const &fetch,
+    bool const t_use_events)
+    : first{ t_first }, count{ t_count },
+      region{ ctx.request_state_region(uint64_t{ count } * sizeof(T)) },
+      id{ ctx.cm_ids[ctx.state_qp()] },
+      ring{ ctx.rings[ctx.state_qp()] }, max_wrs{ fetch.wr_window },
+      signal_interval{ fetch.signal_interval }, use_events{ t_use_events },
+      staging{ famgraph::RDMA_mmap_unique<T>(STAGING_ENTRIES, ctx.pd, false) }
+  {
+    BOOST_LOG_TRIVIAL(info) << "remote vertex state: vertices [" << first << ", "
+                            << first + count << "), "
+                            << (uint64_t{ count } * sizeof(T) >> 20) << " MiB";
+  }
+
+  // Buffers v's new value. v must be in the remote range. Safe to call from any worker.
+  void put(uint32_t const v, T const &value)
+  {
+    pending.local().emplace_back(v, value);
+  }
+
+  // Writes back everything put() since the last flush. The last value put for a
+  // vertex wins if a thread put it more than once.
+  void flush()
+  {
+    merged.clear();
+    for (auto &local : pending) {
+      merged.insert(merged.end(), local.begin(), local.end());
+      local.clear();
+    }
+    if (merged.empty()) return;
+    puts += merged.size();
+    std::stable_sort(merged.begin(), merged.end(), [](auto const &a, auto const &b) {
+      return a.first < b.first;
+    });
+
+    T *const buf = staging.get();
+    uint32_t used = 0;// staged values
+    uint32_t run_start = 0;// staging index of the current run
+    uint32_t run_vertex = 0;// its first vertex
+    auto close_run = [&] {
+      if (used == run_start) return;
+      add_wr(IBV_WR_RDMA_WRITE, run_vertex, used - run_start, buf + run_start);
+      ++write_wrs;
+    };
+    for (size_t i = 0; i < merged.size(); ++i) {
+      auto const v = merged[i].first;
+      if (i + 1 < merged.size() && merged[i + 1].first == v) continue;// superseded
+
+      bool const extends = used > run_start && used < STAGING_ENTRIES
+                           && v == run_vertex + (used - run_start);
+      if (!extends) {
+        close_run();
+        if (used == STAGING_ENTRIES || WRs.size() == max_wrs) {
+          post_and_wait();
+          used = 0;
+        }
+        run_start = used;
+        run_vertex = v;
+      }
+      buf[used++] = merged[i].second;
+      ++writes;
+    }
+    close_run();
+    post_and_wait();
+  }
+
+  // Copies the values of vertices [begin, begin + n) into out.
+  void read(uint32_t const begin, uint32_t const n, T *const out)
+  {
+    for (uint32_t done = 0; done < n;) {
+      auto const chunk = std::min(n - done, STAGING_ENTRIES);
+      add_wr(IBV_WR_RDMA_READ, begin + done, chunk, staging.get());
+      post_and_wait();
+      std::copy_n(staging.get(), chunk, out + done);
+      read_bytes += uint64_t{ chunk } * sizeof(T);
+      done += chunk;
+    }
+  }
+
+  void report() const
+  {
+    BOOST_LOG_TRIVIAL(info) << "remote vertex state: " << puts << " updates, " << writes
+                            << " vertices written with " << write_wrs << " WR's, "
+                            << read_bytes << " bytes read back";
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_REMOTE_STATE_H__
@@ -1,5 +1,13 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <limits>
+#include <deque>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 
 #include <server_runtime.hpp>
 
@@ -14,6 +22,8 @@
 #include <sys/types.h>//for open
 #include <sys/stat.h>//for open
 #include <fcntl.h>//for open
+#include <arpa/inet.h>//for htonl
+#include <numa.h>//for numa_run_on_node
 
 #include "mmap_util.hpp"
 #include "connection_utils.hpp"
@@ -30,15 +40,308 @@ void validate_params(boost::program_options::variables_map const &vm)
   if (!vm.count("port"))
     throw boost::program_options::validation_error(
       boost::program_options::validation_error::invalid_option_value, "port");
-  if (!vm.count("edgefile"))
+  if (!vm.count("edgefile") && !vm.count("serve-graph"))
     throw boost::program_options::validation_error(
       boost::program_options::validation_error::invalid_option_value, "edgefile");
+  if (vm["shard"].as<uint32_t>() >= vm["shards"].as<uint32_t>())
+    throw boost::program_options::validation_error(
+      boost::program_options::validation_error::invalid_option_value, "shard");
+  if (vm["shards"].as<uint32_t>() > 1 && !vm.count("indexfile"))
+    throw boost::program_options::validation_error(
+      boost::program_options::validation_error::invalid_option_value, "indexfile");
+}
+
+struct graph_spec
+{
+  std::string name;
+  std::string adj;
+  std::string in_adj;// the rest are optional
+  std::string index;
+  std::string in_index;
+  std::string weights;
+};
+
+// The file next to path with extension ext, if there is one.
+std::string sibling(std::string const &path, char const *const ext)
+{
+  if (path.empty()) return "";
+  auto p = boost::filesystem::path(path).replace_extension(ext);
+  return boost::filesystem::is_regular_file(p) ? p.string() : "";
+}
+
+// The graphs to preload: --edgefile (with --in-edgefile, --indexfile, --in-indexfile
+// and --weightfile), named after its file, and every entry of --serve-graph
+// NAME=ADJ[:IN_ADJ],... A graph's index is also served when an .idx sits next to its
+// .adj, and so are its weights when a .wgt does.
+std::vector<graph_spec> graph_specs(boost::program_options::variables_map const &vm)
+{
+  std::vector<graph_spec> specs;
+  auto option = [&](char const *const name) {
+    return vm.count(name) ? vm[name].as<std::string>() : "";
+  };
+  if (vm.count("edgefile")) {
+    auto const adj = vm["edgefile"].as<std::string>();
+    specs.push_back({ boost::filesystem::path(adj).stem().string(),
+      adj,
+      option("in-edgefile"),
+      option("indexfile"),
+      option("in-indexfile"),
+      option("weightfile") });
+  }
+  if (vm.count("serve-graph")) {
+    auto const list = vm["serve-graph"].as<std::string>();
+    for (size_t begin = 0; begin < list.size();) {
+      auto end = list.find(',', begin);
+      if (end == std::string::npos) end = list.size();
+      auto const entry = list.substr(begin, end - begin);
+      begin = end + 1;
+
+      auto const eq = entry.find('=');
+      if (eq == std::string::npos || eq == 0) {
+        throw std::runtime_error("--serve-graph takes NAME=ADJ[:IN_ADJ], not " + entry);
+      }
+      auto const colon = entry.find(':', eq);
+      specs.push_back({ entry.substr(0, eq),
+        entry.substr(eq + 1, colon == std::string::npos ? colon : colon - eq - 1),
+        colon == std::string::npos ? "" : entry.substr(colon + 1),
+        "",
+        "",
+        "" });
+    }
+  }
+  for (auto &spec : specs) {
+    if (spec.index.empty()) spec.index = sibling(spec.adj, ".idx");
+    if (spec.in_index.empty()) spec.in_index = sibling(spec.in_adj, ".idx");
+    if (spec.weights.empty()) spec.weights = sibling(spec.adj, ".wgt");
+  }
+
+  if (specs.size() > CATALOG_MAX) throw std::runtime_error("too many graphs to serve");
+  if (specs.size() > 1 && vm["shards"].as<uint32_t>() > 1) {
+    throw std::runtime_error("a sharded server serves a single graph");
+  }
+  for (size_t i = 0; i < specs.size(); ++i) {
+    if (specs[i].name.size() >= GRAPH_NAME_MAX) {
+      throw std::runtime_error("graph name too long: " + specs[i].name);
+    }
+    for (size_t j = 0; j < i; ++j) {
+      if (specs[j].name == specs[i].name) {
+        throw std::runtime_error("two graphs named " + specs[i].name);
+      }
+    }
+  }
+  return specs;
 }
 
+// Serves gather requests (see messages.hpp) arriving on the data QPs. Pool thread t
+// polls the CQs of data QPs t, t + n, t + 2n, ... and answers each request by copying
+// its extents back to back into one of its reply buffers, then writing that buffer
+// to the client with a single RDMA_WRITE_WITH_IMM. A reply buffer is reused once its
+// write has completed; requests wait in a queue while all of a thread's buffers are
+// in flight.
+class gather_pool
+{
+  static constexpr uint32_t MAX_QPS = 1024;
+  static constexpr uint32_t REPLY_BUFFERS = 4;// per thread
+
+  struct data_qp
+  {
+    struct rdma_cm_id *id;
+    std::unique_ptr<gather_request, famgraph::RDMA_mmap_deleter> requests;// per slot
+  };
+
+  struct region
+  {
+    uintptr_t addr;
+    uint64_t bytes;
+  };
+
+  uint32_t const gather_bytes;
+  bool const use_HP;
+  std::vector<region> regions;
+  std::array<std::unique_ptr<data_qp>, MAX_QPS> qps;
+  std::atomic<uint32_t> num_qps{ 0 };
+  std::atomic<bool> stop{ false };
+  std::vector<std::thread> threads;
+
+  void post_request_receive(data_qp &q, uint64_t const slot) noexcept
+  {
+    struct ibv_recv_wr wr, *bad_wr = NULL;
+    struct ibv_sge sge;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = slot;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    sge.addr = reinterpret_cast<uintptr_t>(q.requests.get() + slot);
+    sge.length = sizeof(gather_request);
+    sge.lkey = q.requests.get_deleter().mr->lkey;
+    TEST_NZ(ibv_post_recv(q.id->qp, &wr, &bad_wr));
+  }
+
+  uint8_t const *translate(gather_extent const &e) const noexcept
+  {
+    for (auto const &r : regions) {
+      if (e.addr >= r.addr && e.addr + e.length <= r.addr + r.bytes) {
+        return reinterpret_cast<uint8_t const *>(e.addr);
+      }
+    }
+    rc_die("gather extent outside the served edge arrays");
+    return nullptr;
+  }
+
+  void serve(data_qp &q,
+    uint64_t const slot,
+    uint8_t *const out,
+    uint32_t lkey,
+    uint64_t b)
+  {
+    auto const &req = q.requests.get()[slot];
+    if (req.count > GATHER_MAX_EXTENTS || req.bytes > gather_bytes) {
+      rc_die("gather request exceeds the advertised limits");
+    }
+
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < req.count; ++i) {
+      auto const &e = req.extents[i];
+      if (pos + e.length > req.bytes) rc_die("gather extents exceed request size");
+      std::memcpy(out + pos, translate(e), e.length);
+      pos += e.length;
+    }
+
+    struct ibv_send_wr wr, *bad_wr = NULL;
+    struct ibv_sge sge;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = b;
+    wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+    wr.send_flags = IBV_SEND_SIGNALED;
+    wr.imm_data = htonl(req.seq);
+    wr.wr.rdma.remote_addr = req.reply_addr;
+    wr.wr.rdma.rkey = req.reply_rkey;
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+    sge.addr = reinterpret_cast<uintptr_t>(out);
+    sge.length = pos;
+    sge.lkey = lkey;
+
+    // the request has been consumed; repost its slot before the reply can let the
+    // client send another
+    post_request_receive(q, slot);
+    TEST_NZ(ibv_post_send(q.id->qp, &wr, &bad_wr));
+  }
+
+  void run(uint32_t const t, uint32_t const n_threads)
+  {
+    auto replies = famgraph::RDMA_mmap_unique<uint8_t>(
+      uint64_t{ REPLY_BUFFERS } * gather_bytes, rc_get_pd(), use_HP);
+    uint32_t const lkey = replies.get_deleter().mr->lkey;
+    std::array<bool, REPLY_BUFFERS> busy{};
+    std::deque<std::pair<data_qp *, uint64_t>> pending;
+    struct ibv_wc wc[16];
+
+    while (!stop.load(std::memory_order_relaxed)) {
+      uint32_t const n = num_qps.load(std::memory_order_acquire);
+      for (uint32_t k = t; k < n; k += n_threads) {
+        auto &q = *qps[k];
+        int const got = ibv_poll_cq(q.id->recv_cq, 16, wc);
+        if (got < 0) rc_die("ibv_poll_cq failed");
+        for (int i = 0; i < got; ++i) {
+          if (wc[i].status != IBV_WC_SUCCESS) {
+            BOOST_LOG_TRIVIAL(fatal) << "gather completion error: "
+                                     << ibv_wc_status_str(wc[i].status);
+            rc_die("gather completion error");
+          }
+          if (wc[i].opcode == IBV_WC_RDMA_WRITE) {
+            busy[wc[i].wr_id] = false;
+          } else if (wc[i].opcode == IBV_WC_RECV) {
+            pending.emplace_back(&q, wc[i].wr_id);
+          }
+        }
+      }
+
+      for (uint64_t b = 0; b < REPLY_BUFFERS && !pending.empty(); ++b) {
+        if (busy[b]) continue;
+        auto const [q, slot] = pending.front();
+        pending.pop_front();
+        serve(*q, slot, replies.get() + b * gather_bytes, lkey, b);
+        busy[b] = true;
+      }
+    }
+  }
+
+public:
+  gather_pool(uint32_t const n_threads,
+    uint32_t const t_gather_bytes,
+    bool const t_use_HP)
+    : gather_bytes{ t_gather_bytes }, use_HP{ t_use_HP }
+  {
+    for (uint32_t t = 0; t < n_threads; ++t) {
+      threads.emplace_back([this, t, n_threads] { run(t, n_threads); });
+    }
+  }
+
+  ~gather_pool()
+  {
+    stop.store(true);
+    for (auto &t : threads) t.join();
+  }
+
+  gather_pool &operator=(const gather_pool &) = delete;
+  gather_pool(const gather_pool &) = delete;
+
+  uint32_t max_reply() const noexcept { return gather_bytes; }
+
+  // Edge arrays that extents may point into. Call before any data QP is added.
+  void add_region(void const *const addr, uint64_t const bytes)
+  {
+    regions.push_back({ reinterpret_cast<uintptr_t>(addr), bytes });
+  }
+
+  // Posts request receives on a newly established data QP and hands it to a thread.
+  void add_qp(struct rdma_cm_id *id)
+  {
+    uint32_t const k = num_qps.load(std::memory_order_relaxed);
+    if (k == MAX_QPS) rc_die("too many data QPs for the gather pool");
+    qps[k] = std::make_unique<data_qp>(data_qp{ id,
+      famgraph::RDMA_mmap_unique<gather_request>(GATHER_SLOTS, rc_get_pd(), use_HP) });
+    for (uint64_t slot = 0; slot < GATHER_SLOTS; ++slot) {
+      post_request_receive(*qps[k], slot);
+    }
+    num_qps.store(k + 1, std::memory_order_release);
+  }
+};
+
+struct load_options
+{
+  uint32_t threads{ 1 };
+  bool direct{ false };// O_DIRECT
+  bool map_shared{ false };// register the page cache instead of a private copy
+};
+
+// A graph preloaded at startup and served to every job.
+struct served_graph
+{
+  std::string name;
+  std::unique_ptr<uint32_t, famgraph::RDMA_mmap_deleter> edges;
+  std::unique_ptr<uint32_t, famgraph::RDMA_mmap_deleter> in_edges;// may be null
+  std::unique_ptr<uint64_t, famgraph::RDMA_mmap_deleter> index;// may be null
+  std::unique_ptr<uint64_t, famgraph::RDMA_mmap_deleter> in_index;// may be null
+  std::unique_ptr<float, famgraph::RDMA_mmap_deleter> weights;// may be null
+  graph_region region;
+  uint32_t num_vertices{ 0 };// 0 without an index
+  uint32_t max_out_degree{ 0 };
+  std::vector<named_region> regions;// everything above, as listed in the catalog
+};
+
+// The server outlives its clients: the graphs are loaded and registered once, and
+// each client job gets fresh message buffers, a gather pool and vertex state regions
+// that are released when it disconnects.
 struct conn_context// consider renaming server context
 {
-  std::string adj_filename;
-  std::vector<std::unique_ptr<uint32_t, famgraph::RDMA_mmap_deleter>> v;
+  std::vector<served_graph> graphs;// the catalog
+  std::vector<std::unique_ptr<uint32_t, famgraph::RDMA_mmap_deleter>> v;// per job
+  uint32_t gather_threads{ 0 };
+  uint32_t gather_bytes{ 0 };
+  std::unique_ptr<gather_pool> gather;
+  uint64_t jobs{ 0 };
 
   struct message *tx_msg;
   struct ibv_mr *tx_msg_mr;
@@ -47,9 +350,15 @@ struct conn_context// consider renaming server context
   struct ibv_mr *rx_msg_mr;
 
   bool use_hp{ false };
+  load_options load;
 
-  conn_context(std::string const &file) : adj_filename{ file } {}
+  // this server holds shard `shard` of `shards` vertex-range shards of the edge array,
+  // cut using the graph's .idx
+  uint32_t shard{ 0 };
+  uint32_t shards{ 1 };
+  std::string index_filename;
 
+  conn_context() = default;
   conn_context &operator=(const conn_context &) = delete;
   conn_context(const conn_context &) = delete;
 };
@@ -61,65 +370,246 @@ template<typename T> auto num_elements(boost::filesystem::path const &p)
   return n;
 }
 
-class file_mapper
+// Reads bytes [begin, end) of a file into dst with `threads` threads. The range is cut
+// into LOAD_BLOCK blocks and thread t reads blocks t, t + threads, ... while running
+// on NUMA node t % nodes. dst must not have been touched yet: each block's pages are
+// then allocated on its reader's node, striping the array across the nodes.
+//
+// With direct set, and begin page aligned, the file is read with O_DIRECT, which
+// skips the page cache copy. Block lengths are rounded up to whole pages for it, so
+// dst must have room up to its next page boundary.
+class range_loader
 {
-  constexpr static uint64_t default_chunk = 30UL * (1 << 30);// 30 GB
-  uint64_t const chunk_size{ default_chunk };
-  uint64_t offset{ 0 };
-  uint64_t filesize;
-  int fd;
-
-public:
-  file_mapper(std::string const &file, uint64_t t_fsize)
-    : filesize{ t_fsize }, fd{ open(file.c_str(), O_RDONLY) }
+  static constexpr uint64_t LOAD_BLOCK = 64UL << 20;// 64 MiB
+  static constexpr uint64_t PAGE = 4096;
+
+  std::string const file;
+  uint64_t const begin;
+  uint64_t const end;
+  uint32_t const threads;
+  bool const direct;
+
+  // Runs block_fn(t) on every thread t, each bound to its NUMA node, and logs the
+  // bandwidth.
+  template<typename F> void run(F const &block_fn, char const *const how) const
   {
-    if (this->fd == -1) { throw std::runtime_error("open() failed on .adj file"); }
+    int const nodes = numa_available() == -1 ? 0 : numa_num_configured_nodes();
+
+    auto const t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    std::vector<std::exception_ptr> errors(threads);
+    for (uint32_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+        int const node = static_cast<int>(t) % std::max(nodes, 1);
+        if (nodes > 1 && numa_run_on_node(node)) {
+          BOOST_LOG_TRIVIAL(warning) << "loader " << t << " could not run on node "
+                                     << node;
+        }
+        try {
+          block_fn(t);
+        } catch (...) {
+          errors[t] = std::current_exception();
+        }
+      });
+    }
+    for (auto &th : pool) th.join();
+    for (auto const &e : errors) {
+      if (e) std::rethrow_exception(e);
+    }
+
+    std::chrono::duration<double> const secs = std::chrono::steady_clock::now() - t0;
+    auto const bytes = static_cast<double>(end - begin);
+    BOOST_LOG_TRIVIAL(info) << how << " " << (end - begin) << " bytes of " << file
+                            << " in " << secs.count() << " s ("
+                            << bytes / secs.count() / 1e9 << " GB/s) with " << threads
+                            << " threads" << (direct ? ", O_DIRECT" : "")
+                            << (nodes > 1 ? ", striped over NUMA nodes" : "");
   }
-  
-  ~file_mapper() { close(this->fd);}
 
-  file_mapper(const file_mapper &) = delete;
-  file_mapper &operator=(const file_mapper &) = delete;
+  void read_blocks(int const fd, char *const dst, uint32_t const t) const
+  {
+    uint64_t const len = end - begin;
+    for (uint64_t off = t * LOAD_BLOCK; off < len; off += threads * LOAD_BLOCK) {
+      uint64_t want = std::min(LOAD_BLOCK, len - off);
+      if (direct) want = (want + PAGE - 1) / PAGE * PAGE;
+      uint64_t done = 0;
+      while (done < want) {
+        auto const r = pread(
+          fd, dst + off + done, want - done, static_cast<off_t>(begin + off + done));
+        if (r < 0) throw std::runtime_error("pread() failed on " + file);
+        done += static_cast<uint64_t>(r);
+        // end of file, only expected in a rounded up O_DIRECT read
+        if (r == 0 || (direct && static_cast<uint64_t>(r) % PAGE)) break;
+      }
+      if (done < std::min(LOAD_BLOCK, len - off)) {
+        throw std::runtime_error("short read on " + file);
+      }
+    }
+  }
 
-  bool has_next() noexcept { return this->offset < this->filesize; }
+  // Reads one byte of every page, faulting the blocks of thread t into the page cache.
+  void touch_blocks(char const *const src, uint32_t const t) const
+  {
+    uint64_t const len = end - begin;
+    uint64_t sum = 0;
+    for (uint64_t off = t * LOAD_BLOCK; off < len; off += threads * LOAD_BLOCK) {
+      uint64_t const block_end = off + std::min(LOAD_BLOCK, len - off);
+      for (uint64_t pos = off; pos < block_end; pos += PAGE) {
+        sum += static_cast<uint8_t>(*static_cast<char const volatile *>(src + pos));
+      }
+    }
+    (void)sum;
+  }
 
-  auto operator()()
+public:
+  range_loader(std::string t_file,
+    uint64_t const t_begin,
+    uint64_t const t_end,
+    uint32_t const t_threads,
+    bool const t_direct)
+    : file{ std::move(t_file) }, begin{ t_begin }, end{ t_end },
+      threads{ std::max(t_threads, 1u) }, direct{ t_direct && t_begin % PAGE == 0 }
   {
-    auto length = std::min(this->chunk_size, this->filesize - this->offset);
-    auto del = [length](void *p) {
-      auto r = munmap(p, length);
-      if (r) BOOST_LOG_TRIVIAL(fatal) << "munmap chunk failed";
-    };
+    if (t_direct && !direct) {
+      BOOST_LOG_TRIVIAL(info) << "range of " << file
+                              << " is not page aligned, reading through the page cache";
+    }
+  }
 
-    auto constexpr flags = MAP_PRIVATE | MAP_POPULATE;
-    auto ptr = mmap(0, length, PROT_READ, flags, this->fd, static_cast<long>(this->offset));
-    this->offset += length;
+  // Reads the range into dst.
+  void operator()(char *const dst) const
+  {
+    int const fd = open(file.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+    if (fd == -1) throw std::runtime_error("open() failed on " + file);
+    try {
+      run([&](uint32_t const t) { read_blocks(fd, dst, t); }, "loaded");
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
 
-    return make_pair(std::unique_ptr<void, decltype(del)>(ptr, del), length);
+  // Faults a mapping of the range, src, into the page cache.
+  void prefault(char const *const src) const
+  {
+    run([&](uint32_t const t) { touch_blocks(src, t); }, "faulted in");
   }
 };
 
-auto get_edge_list(std::string file, ibv_pd *pd, bool use_HP)
+uint64_t count_edges(std::string const &file)
 {
   namespace fs = boost::filesystem;
 
   fs::path p(file);
   if (!(fs::exists(p) && fs::is_regular_file(p)))
     throw std::runtime_error(".adj file not found");
+  return num_elements<uint32_t>(p);
+}
 
-  auto const edges = num_elements<uint32_t>(p);
-  auto ptr = famgraph::RDMA_mmap_unique<uint32_t>(edges, pd, use_HP);
-  auto array = reinterpret_cast<char*>(ptr.get());
-  auto const filesize = edges * sizeof(uint32_t);
-  file_mapper get_mapped_chunk{file, filesize};
+// The edges [first, last) of shard `shard` when a graph of graph_edges edges is cut
+// into `shards` vertex ranges of about equal edge count. index_file is the graph's
+// .idx, the offset of every vertex's first edge.
+std::pair<uint64_t, uint64_t> shard_range(std::string const &index_file,
+  uint64_t const graph_edges,
+  uint32_t const shard,
+  uint32_t const shards)
+{
+  if (shards == 1) return { 0, graph_edges };
+
+  int const fd = open(index_file.c_str(), O_RDONLY);
+  if (fd == -1) throw std::runtime_error("open() failed on .idx file");
+  auto const bytes = boost::filesystem::file_size(index_file);
+  auto const n = bytes / sizeof(uint64_t);
+  auto *const map = mmap(0, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) throw std::runtime_error("mmap() failed on .idx file");
+  auto const *const index = static_cast<uint64_t const *>(map);
+
+  // a cut falls on the first vertex whose list starts at or after the even split
+  auto cut = [&](uint32_t const j) -> uint64_t {
+    if (j == shards) return graph_edges;
+    auto const target = graph_edges * j / shards;
+    auto const it = std::lower_bound(index, index + n, target);
+    return it == index + n ? graph_edges : *it;
+  };
+  std::pair<uint64_t, uint64_t> const range{ cut(shard), cut(shard + 1) };
+  munmap(map, bytes);
+  return range;
+}
 
-  while (get_mapped_chunk.has_next()){
-    auto const [fptr, len] = get_mapped_chunk();
-    std::memcpy(array, fptr.get(), len);
-    array += len;
-    std::cout << "#" << std::flush;
+// Registers elements [first, last) of an array of T in file where they sit in the page
+// cache, with no private copy. The mapping starts at a boundary of the file's block
+// size, so a file on hugetlbfs is mapped, and pinned, in huge pages. The pages are
+// faulted in by the loader threads before ibv_reg_mr() pins them.
+template<typename T>
+std::unique_ptr<T, famgraph::RDMA_mmap_deleter> map_array(std::string const &file,
+  ibv_pd *pd,
+  range_loader const &loader,
+  uint64_t const first,
+  uint64_t const last)
+{
+  int const fd = open(file.c_str(), O_RDONLY);
+  if (fd == -1) throw std::runtime_error("open() failed on " + file);
+  struct stat st;
+  if (fstat(fd, &st)) {
+    close(fd);
+    throw std::runtime_error("fstat() failed on " + file);
+  }
+  auto const align = std::max(static_cast<uint64_t>(sysconf(_SC_PAGESIZE)),
+    static_cast<uint64_t>(st.st_blksize));
+  auto const begin = first * sizeof(T);
+  auto const skip = begin % align;
+  auto const len = last * sizeof(T) - begin + skip;
+
+  auto *const map =
+    mmap(0, len, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(begin - skip));
+  close(fd);
+  if (map == MAP_FAILED) throw std::runtime_error("mmap() failed on " + file);
+  auto *const edges = static_cast<char *>(map) + skip;
+
+  loader.prefault(edges);
+  // read only: the pages belong to the file
+  auto *const mr = ibv_reg_mr(pd, map, len, IBV_ACCESS_REMOTE_READ);
+  if (!mr) {
+    munmap(map, len);
+    throw std::runtime_error("ibv_reg_mr() failed on the mapping of " + file);
+  }
+  BOOST_LOG_TRIVIAL(info) << "registered " << len << " bytes of " << file
+                          << " in place (MAP_SHARED)";
+  return std::unique_ptr<T, famgraph::RDMA_mmap_deleter>(
+    reinterpret_cast<T *>(edges), famgraph::RDMA_mmap_deleter(len, mr));
+}
+
+// Loads elements [first, last) of an array of T in file into registered memory. An
+// empty range, such as the shard of a server whose cuts both fall after one hub,
+// registers nothing and yields a null array and MR.
+template<typename T = uint32_t>
+auto get_array(std::string file,
+  ibv_pd *pd,
+  bool use_HP,
+  load_options const &load,
+  uint64_t const first = 0,
+  uint64_t last = std::numeric_limits<uint64_t>::max())
+{
+  last = std::min(last, uint64_t{ num_elements<T>(file) });
+  if (first >= last) {
+    return std::make_tuple(std::unique_ptr<T, famgraph::RDMA_mmap_deleter>(
+                             nullptr, famgraph::RDMA_mmap_deleter(0, nullptr)),
+      static_cast<struct ibv_mr *>(nullptr),
+      uint64_t{ 0 });
   }
-  
+  auto const edges = last - first;
+  range_loader const loader{
+    file, first * sizeof(T), last * sizeof(T), load.threads, load.direct
+  };
+  auto ptr = load.map_shared
+               ? map_array<T>(file, pd, loader, first, last)
+               : famgraph::RDMA_mmap_unique_filled<T>(edges,
+                 pd,
+                 use_HP,
+                 [&loader](T *const array) { loader(reinterpret_cast<char *>(array)); });
+
   auto mr = ptr.get_deleter().mr;
   return std::make_tuple(std::move(ptr), mr, edges);
 }
@@ -191,22 +681,160 @@ void on_pre_conn(struct rdma_cm_id *id)
   post_receive(id);
 }
 
+template<typename T>
+named_region make_region(char const *const name,
+  std::unique_ptr<T, famgraph::RDMA_mmap_deleter> const &array,
+  uint64_t const count)
+{
+  named_region r{};
+  std::string(name).copy(r.name, REGION_NAME_MAX - 1);
+  r.addr = reinterpret_cast<uintptr_t>(array.get());
+  r.bytes = count * sizeof(T);
+  r.rkey = array ? array.get_deleter().mr->rkey : 0;
+  return r;
+}
+
+// The largest out-degree in an index of n vertices and graph_edges edges.
+uint32_t max_out_degree(uint64_t const *const index,
+  uint64_t const n,
+  uint64_t const graph_edges)
+{
+  uint64_t max = 0;
+  for (uint64_t v = 0; v < n; ++v) {
+    max = std::max(max, (v + 1 < n ? index[v + 1] : graph_edges) - index[v]);
+  }
+  return static_cast<uint32_t>(max);
+}
+
+// Loads and registers the graph spec names for the catalog: its edges and whichever of
+// the transposed edges, the indexes and the weights it has.
+served_graph load_graph(conn_context const &ctx, graph_spec const &spec)
+{
+  BOOST_LOG_TRIVIAL(info) << "Loading graph " << spec.name << " from " << spec.adj;
+  auto const graph_edges = count_edges(spec.adj);
+  auto const [first, last] =
+    shard_range(ctx.index_filename, graph_edges, ctx.shard, ctx.shards);
+  BOOST_LOG_TRIVIAL(info) << "shard " << ctx.shard << " of " << ctx.shards
+                          << ": edges [" << first << ", " << last << ") of "
+                          << graph_edges;
+  if (first == last) {
+    BOOST_LOG_TRIVIAL(warning) << "shard " << ctx.shard << " is empty: the vertex at "
+                               << "its cut holds more than 1/" << ctx.shards
+                               << " of the edges";
+  }
+  auto [ptr, mr, edges] =
+    get_array(spec.adj, rc_get_pd(), ctx.use_hp, ctx.load, first, last);
+
+  graph_region region{};
+  region.addr = reinterpret_cast<uintptr_t>(ptr.get());
+  region.rkey = mr ? mr->rkey : 0;
+  region.total_edges = edges;
+  region.first_edge = first;
+  region.graph_edges = graph_edges;
+  std::vector<named_region> regions{ make_region("edges", ptr, edges) };
+
+  // Loads elements [b, e) of file, unless there is no such file, and lists them as
+  // region name.
+  auto load_optional = [&](auto element,
+                         std::string const &file,
+                         char const *const name,
+                         uint64_t const b = 0,
+                         uint64_t const e = std::numeric_limits<uint64_t>::max()) {
+    using T = decltype(element);
+    if (file.empty()) {
+      return std::unique_ptr<T, famgraph::RDMA_mmap_deleter>(
+        nullptr, famgraph::RDMA_mmap_deleter(0, nullptr));
+    }
+    BOOST_LOG_TRIVIAL(info) << "Reading " << name << " from " << file;
+    auto [array, array_mr, n] =
+      get_array<T>(file, rc_get_pd(), ctx.use_hp, ctx.load, b, e);
+    regions.push_back(make_region(name, array, n));
+    return std::move(array);
+  };
+
+  auto in_ptr = load_optional(uint32_t{}, spec.in_adj, "in-edges");
+  if (in_ptr) {
+    region.in_addr = reinterpret_cast<uintptr_t>(in_ptr.get());
+    region.in_rkey = in_ptr.get_deleter().mr->rkey;
+    region.total_in_edges = regions.back().bytes / sizeof(uint32_t);
+  }
+
+  auto index = load_optional(uint64_t{}, spec.index, "index");
+  uint32_t num_vertices = 0;
+  uint32_t max_degree = 0;
+  if (index) {
+    auto const n = regions.back().bytes / sizeof(uint64_t);
+    if (n > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error(spec.index + " has more than 2^32 vertices");
+    }
+    num_vertices = static_cast<uint32_t>(n);
+    max_degree = max_out_degree(index.get(), n, graph_edges);
+    BOOST_LOG_TRIVIAL(info) << "|V| " << num_vertices << ", max out degree "
+                            << max_degree;
+  }
+  auto in_index = load_optional(uint64_t{}, spec.in_index, "in-index");
+
+  if (!spec.weights.empty() && num_elements<float>(spec.weights) != graph_edges) {
+    throw std::runtime_error(spec.weights + " does not hold one weight per edge");
+  }
+  // sharded like the edges they belong to
+  auto weights = load_optional(float{}, spec.weights, "weights", first, last);
+
+  return served_graph{ spec.name,
+    std::move(ptr),
+    std::move(in_ptr),
+    std::move(index),
+    std::move(in_index),
+    std::move(weights),
+    region,
+    num_vertices,
+    max_degree,
+    std::move(regions) };
+}
+
+// A new job: answer with the catalog.
 void on_connection(struct rdma_cm_id *id)
 {
   BOOST_LOG_TRIVIAL(debug) << "on connection";
   struct conn_context *ctx = static_cast<struct conn_context *>(id->context);
+  BOOST_LOG_TRIVIAL(info) << "job " << ++ctx->jobs << " connected";
+
+  if (ctx->gather_threads > 0) {
+    ctx->gather = std::make_unique<gather_pool>(
+      ctx->gather_threads, ctx->gather_bytes, ctx->use_hp);
+    for (auto const &g : ctx->graphs) {
+      ctx->gather->add_region(g.edges.get(), g.region.total_edges * sizeof(uint32_t));
+      if (g.in_edges) {
+        ctx->gather->add_region(
+          g.in_edges.get(), g.region.total_in_edges * sizeof(uint32_t));
+      }
+    }
+  }
 
-  auto [ptr, mr, edges] = get_edge_list(ctx->adj_filename, rc_get_pd(), ctx->use_hp);
-  ctx->v.emplace_back(std::move(ptr));
-  
-  ctx->tx_msg->id = MSG_MR;
-  ctx->tx_msg->data.mr.addr = reinterpret_cast<uintptr_t>(mr->addr);
-  ctx->tx_msg->data.mr.rkey = mr->rkey;
-  ctx->tx_msg->data.mr.total_edges = edges;
+  ctx->tx_msg->id = MSG_CATALOG;
+  ctx->tx_msg->data.catalog.version = PROTOCOL_VERSION;
+  ctx->tx_msg->data.catalog.count = static_cast<uint32_t>(ctx->graphs.size());
+  for (size_t i = 0; i < ctx->graphs.size(); ++i) {
+    auto &entry = ctx->tx_msg->data.catalog.graphs[i];
+    auto const &g = ctx->graphs[i];
+    memset(entry.name, 0, sizeof(entry.name));
+    g.name.copy(entry.name, GRAPH_NAME_MAX - 1);
+    entry.region = g.region;
+    entry.region.gather_bytes = ctx->gather ? ctx->gather->max_reply() : 0;
+    entry.num_vertices = g.num_vertices;
+    entry.max_out_degree = g.max_out_degree;
+    entry.region_count = static_cast<uint32_t>(g.regions.size());
+    std::copy(g.regions.begin(), g.regions.end(), entry.regions);
+  }
 
   send_message(id);
 }
 
+void on_data_connection(struct rdma_cm_id *id)
+{
+  if (g_ctx->gather) g_ctx->gather->add_qp(id);
+}
+
 void on_completion(struct ibv_wc *wc)
 {
   BOOST_LOG_TRIVIAL(debug) << "completion";
@@ -219,6 +847,21 @@ void on_completion(struct ibv_wc *wc)
       BOOST_LOG_TRIVIAL(debug) << "received READY";
       ctx->tx_msg->id = MSG_DONE;
       send_message(id);
+    } else if (ctx->rx_msg->id == MSG_STATE) {
+      // a zeroed region the client keeps part of its vertex table in
+      auto const bytes = ctx->rx_msg->data.state.bytes;
+      post_receive(id);
+      auto state = famgraph::RDMA_mmap_unique<uint32_t>((bytes + 3) / 4,
+        rc_get_pd(),
+        ctx->use_hp,
+        unsigned{ famgraph::IB_FLAGS | IBV_ACCESS_REMOTE_WRITE });
+      BOOST_LOG_TRIVIAL(info) << "registered " << bytes << " bytes of vertex state";
+      ctx->tx_msg->id = MSG_STATE;
+      ctx->tx_msg->data.state.bytes = bytes;
+      ctx->tx_msg->data.state.addr = reinterpret_cast<uintptr_t>(state.get());
+      ctx->tx_msg->data.state.rkey = state.get_deleter().mr->rkey;
+      ctx->v.emplace_back(std::move(state));
+      send_message(id);
     } else if (ctx->rx_msg->id == MSG_DONE) {// server never receives this
       printf("received DONE\n");
       post_receive(id);
@@ -230,14 +873,20 @@ void on_completion(struct ibv_wc *wc)
   }
 }
 
-void on_disconnect(struct rdma_cm_id *id)
+// The job is over; the graphs stay registered for the next one. id may be any of the
+// job's QPs.
+void on_disconnect(struct rdma_cm_id *)
 {
-  struct conn_context *ctx = static_cast<struct conn_context *>(id->context);
+  struct conn_context *ctx = g_ctx;
 
+  ctx->gather.reset();// stops the pool before the data QPs go away
+  ctx->v.clear();
   ibv_dereg_mr(ctx->rx_msg_mr);
   ibv_dereg_mr(ctx->tx_msg_mr);
   free(ctx->rx_msg);
   free(ctx->tx_msg);
+  BOOST_LOG_TRIVIAL(info) << "job " << ctx->jobs << " disconnected, serving "
+                          << ctx->graphs.size() << " graphs";
 }
 }// namespace
 
@@ -247,22 +896,45 @@ void run_server(boost::program_options::variables_map const &vm)
   validate_params(vm);
   std::string server_ip = vm["server-addr"].as<std::string>();
   std::string server_port = vm["port"].as<std::string>();
-  std::string file = vm["edgefile"].as<std::string>();
+  auto const specs = graph_specs(vm);
 
   BOOST_LOG_TRIVIAL(info) << "Starting server";
   BOOST_LOG_TRIVIAL(info) << "Server IPoIB address: " << server_ip
                           << " port: " << server_port;
 
-  BOOST_LOG_TRIVIAL(info) << "Reading in edgelist";
-
-  struct conn_context ctx{file};
+  struct conn_context ctx;
   ctx.use_hp = vm.count("hp") ? true : false;
+  auto const load_threads = vm["load-threads"].as<uint32_t>();
+  ctx.load.threads =
+    load_threads ? load_threads : std::max(std::thread::hardware_concurrency(), 1u);
+  ctx.load.direct = vm.count("direct-io") ? true : false;
+  ctx.load.map_shared = vm.count("map-shared") ? true : false;
+  ctx.shard = vm["shard"].as<uint32_t>();
+  ctx.shards = vm["shards"].as<uint32_t>();
+  if (vm.count("indexfile")) ctx.index_filename = vm["indexfile"].as<std::string>();
+  ctx.gather_threads = vm["gather-threads"].as<uint32_t>();
+  ctx.gather_bytes = vm["gather-bytes"].as<uint32_t>();
+  if (ctx.gather_bytes == 0) ctx.gather_threads = 0;
   BOOST_LOG_TRIVIAL(info) << "hugepages? " << ctx.use_hp;
+  BOOST_LOG_TRIVIAL(info) << "load threads: " << ctx.load.threads
+                          << (ctx.load.direct ? " (O_DIRECT)" : "")
+                          << (ctx.load.map_shared ? ", registered in place" : "");
+  BOOST_LOG_TRIVIAL(info) << "gather threads: " << ctx.gather_threads
+                          << " max reply: " << ctx.gather_bytes << " bytes";
   g_ctx = &ctx;
 
+  // the device, and with it the PD, is opened before any client connects, so the
+  // graphs are registered once for all jobs
+  rc_server_bind(server_port.c_str());
+  for (auto const &spec : specs) {
+    ctx.graphs.push_back(load_graph(ctx, spec));
+  }
+
   rc_init(on_pre_conn, on_connection, on_completion, on_disconnect);
+  rc_set_data_connect_cb(on_data_connection);
 
-  BOOST_LOG_TRIVIAL(info) << "waiting for connections. interrupt (^C) to exit.";
+  BOOST_LOG_TRIVIAL(info) << "serving " << ctx.graphs.size()
+                          << " graphs, waiting for jobs. interrupt (^C) to exit.";
 
-  rc_server_loop(server_port.c_str());
+  rc_server_loop();
 }
@@ -0,0 +1,74 @@
+#ifndef __PROJ_SHARD_MAP_H__
+#define __PROJ_SHARD_MAP_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace famgraph {
+// Edges [first_edge, first_edge + num_edges) of the graph, held by one memory server
+// at remote_addr. Shards are cut at vertex boundaries, so every adjacency list lives
+// on exactly one server.
+struct edge_shard
+{
+  uint64_t first_edge;
+  uint64_t num_edges;
+  uint64_t remote_addr;
+  uint32_t rkey;
+};
+
+// The shards of the edge array, one per memory server and in server order. Shard i
+// is served over the client's QPs to server i.
+class shard_map
+{
+  std::vector<edge_shard> shards;
+
+public:
+  void set(size_t const server, edge_shard const &s)
+  {
+    if (server >= shards.size()) shards.resize(server + 1);
+    shards[server] = s;
+  }
+
+  size_t size() const noexcept { return shards.size(); }
+
+  edge_shard const &operator[](size_t const i) const noexcept { return shards[i]; }
+
+  uint64_t total_edges() const noexcept
+  {
+    return shards.empty() ? 0 : shards.back().first_edge + shards.back().num_edges;
+  }
+
+  // The shard holding edge e.
+  uint32_t find(uint64_t const e) const noexcept
+  {
+    auto it = std::upper_bound(shards.begin(),
+      shards.end(),
+      e,
+      [](uint64_t const x, edge_shard const &s) { return x < s.first_edge; });
+    return static_cast<uint32_t>(it - shards.begin()) - 1;
+  }
+
+  // Throws unless the shards tile [0, graph_edges) in server order.
+  void validate(uint64_t const graph_edges) const
+  {
+    uint64_t next = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+      if (shards[i].first_edge != next) {
+        throw std::runtime_error("server " + std::to_string(i) + " holds edges from "
+                                 + std::to_string(shards[i].first_edge) + ", expected "
+                                 + std::to_string(next));
+      }
+      next += shards[i].num_edges;
+    }
+    if (next != graph_edges) {
+      throw std::runtime_error("the servers hold " + std::to_string(next) + " of "
+                               + std::to_string(graph_edges) + " edges");
+    }
+  }
+};
+}// namespace famgraph
+
+#endif// __PROJ_SHARD_MAP_H__
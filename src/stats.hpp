@@ -12,10 +12,26 @@
 #include <boost/log/trivial.hpp>
 #include <boost/log/expressions.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <tuple>
 #include <utility>
 
 namespace famgraph {
+inline constexpr uint32_t MAX_PIPELINE_DEPTH = 16;
+inline constexpr int MAX_NUMA_NODES = 8;
+
+// Work done by the workers of one NUMA node, kept with --numa-aware. Updated once per
+// window, so the atomics stay off the fast path.
+struct alignas(64) node_counters
+{
+  std::atomic<uint64_t> bytes{ 0 };// edge bytes fetched
+  std::atomic<uint64_t> windows{ 0 };
+  std::atomic<long> busy{ 0 };// ns spent in for_each_window tasks
+};
+
 struct FG_stats
 {
   tbb::enumerable_thread_specific<long> spin_time;// 1) spin time
@@ -23,12 +39,40 @@ struct FG_stats
     function_time;// 2) time spent applying functions..
   tbb::enumerable_thread_specific<std::tuple<unsigned int, unsigned int, unsigned int>>
     wrs_verts_sends;
+  // bytes read, bytes of inactive adjacency read through, WR's saved by reading through
+  tbb::enumerable_thread_specific<std::tuple<uint64_t, uint64_t, uint64_t>>
+    read_amplification;
+  // spin time bucketed by how many windows the worker had in flight when it waited
+  tbb::enumerable_thread_specific<std::array<long, MAX_PIPELINE_DEPTH>> spin_by_depth;
+  // windows spent streaming adjacency lists larger than the edge window
+  tbb::enumerable_thread_specific<uint64_t> chunk_windows;
+  // adjacency cache lookups, hits (each one a list not fetched), bytes not fetched
+  tbb::enumerable_thread_specific<std::tuple<uint64_t, uint64_t, uint64_t>> adj_cache;
+  // compressed lists: bytes read, edges they decode to
+  tbb::enumerable_thread_specific<std::pair<uint64_t, uint64_t>> compressed_reads;
+  // gather RPC's sent, READ WR's they replaced
+  tbb::enumerable_thread_specific<std::pair<uint64_t, uint64_t>> gathers;
+  std::array<node_counters, MAX_NUMA_NODES> per_node;
+  int num_nodes{ 0 };// nodes with counters, 0 unless --numa-aware
 
+  uint32_t pipeline_depth{ 1 };
   long total_spin_time{ 0 };
+  std::array<long, MAX_PIPELINE_DEPTH> total_spin_by_depth{};
   long total_function_time{ 0 };
   unsigned int wrs{ 0 };
   unsigned int verts{ 0 };
   unsigned int sends{ 0 };
+  uint64_t bytes_read{ 0 };
+  uint64_t bytes_wasted{ 0 };
+  uint64_t wrs_saved{ 0 };
+  uint64_t total_chunk_windows{ 0 };
+  uint64_t cache_lookups{ 0 };
+  uint64_t cache_hits{ 0 };
+  uint64_t cache_bytes_saved{ 0 };
+  uint64_t compressed_bytes{ 0 };
+  uint64_t compressed_edges{ 0 };
+  uint64_t total_gathers{ 0 };
+  uint64_t gathered_wrs{ 0 };
 };
 
 // const? does combine mutate -- i think const ok
@@ -39,9 +83,26 @@ inline void print_stats_round(FG_stats const &stats)
     BOOST_LOG_TRIVIAL(debug) << static_cast<double>(t) / 1000000000 << " ";
   }
 
+  BOOST_LOG_TRIVIAL(debug) << "Spin Time(s) by windows in flight: ";
+  for (uint32_t d = 0; d < stats.pipeline_depth; ++d) {
+    long t = 0;
+    for (auto const &a : stats.spin_by_depth) t += a[d];
+    BOOST_LOG_TRIVIAL(debug) << d + 1 << ": " << static_cast<double>(t) / 1000000000
+                             << " ";
+  }
+
   BOOST_LOG_TRIVIAL(debug) << "Function Time(s): ";
+  long max_function = 0, sum_function = 0;
   for (auto const &t : stats.function_time) {
     BOOST_LOG_TRIVIAL(debug) << static_cast<double>(t) / 1000000000 << " ";
+    max_function = std::max(max_function, t);
+    sum_function += t;
+  }
+  if (sum_function > 0) {
+    auto const mean = static_cast<double>(sum_function)
+                      / static_cast<double>(stats.function_time.size());
+    BOOST_LOG_TRIVIAL(debug) << "Function Time imbalance (max / mean): "
+                             << static_cast<double>(max_function) / mean;
   }
   BOOST_LOG_TRIVIAL(debug) << "\n";
 
@@ -61,6 +122,54 @@ inline void print_stats_round(FG_stats const &stats)
   }
 
   BOOST_LOG_TRIVIAL(debug) << "\n";
+
+  uint64_t read = 0, wasted = 0, saved = 0;
+  for (auto const &t : stats.read_amplification) {
+    read += std::get<0>(t);
+    wasted += std::get<1>(t);
+    saved += std::get<2>(t);
+  }
+  BOOST_LOG_TRIVIAL(debug) << "Gap coalescing: WR's saved " << saved << " wasted bytes "
+                           << wasted << " of " << read << " read";
+  uint64_t chunks = 0;
+  for (auto const &t : stats.chunk_windows) chunks += t;
+  BOOST_LOG_TRIVIAL(debug) << "Chunk windows: " << chunks;
+
+  uint64_t lookups = 0, hits = 0, saved_bytes = 0;
+  for (auto const &t : stats.adj_cache) {
+    lookups += std::get<0>(t);
+    hits += std::get<1>(t);
+    saved_bytes += std::get<2>(t);
+  }
+  if (lookups > 0) {
+    BOOST_LOG_TRIVIAL(debug) << "Adjacency cache: hit rate "
+                             << static_cast<double>(hits) / static_cast<double>(lookups)
+                             << " bytes saved " << saved_bytes << " WR's avoided "
+                             << hits;
+  }
+
+  uint64_t c_bytes = 0, c_edges = 0;
+  for (auto const &t : stats.compressed_reads) {
+    c_bytes += t.first;
+    c_edges += t.second;
+  }
+  if (c_edges > 0) {
+    BOOST_LOG_TRIVIAL(debug) << "Compressed: " << c_bytes << " bytes for " << c_edges
+                             << " edges ("
+                             << static_cast<double>(c_bytes)
+                                  / static_cast<double>(c_edges)
+                             << " bytes/edge)";
+  }
+
+  uint64_t n_gathers = 0, n_gathered = 0;
+  for (auto const &t : stats.gathers) {
+    n_gathers += t.first;
+    n_gathered += t.second;
+  }
+  if (n_gathers > 0) {
+    BOOST_LOG_TRIVIAL(debug) << "Gathers: " << n_gathers << " replacing " << n_gathered
+                             << " WR's";
+  }
   BOOST_LOG_TRIVIAL(debug) << "\n";
 }
 
@@ -76,6 +185,13 @@ inline void clear_stats_round(FG_stats &stats)
     t = 0;
   }
 
+  for (auto &a : stats.spin_by_depth) {
+    for (uint32_t d = 0; d < MAX_PIPELINE_DEPTH; ++d) {
+      stats.total_spin_by_depth[d] += a[d];
+      a[d] = 0;
+    }
+  }
+
   for (auto &p : stats.wrs_verts_sends) {
     stats.wrs += std::get<0>(p);
     stats.verts += std::get<1>(p);
@@ -84,6 +200,37 @@ inline void clear_stats_round(FG_stats &stats)
     std::get<1>(p) = 0;
     std::get<2>(p) = 0;
   }
+
+  for (auto &t : stats.read_amplification) {
+    stats.bytes_read += std::get<0>(t);
+    stats.bytes_wasted += std::get<1>(t);
+    stats.wrs_saved += std::get<2>(t);
+    t = {};
+  }
+
+  for (auto &t : stats.chunk_windows) {
+    stats.total_chunk_windows += t;
+    t = 0;
+  }
+
+  for (auto &t : stats.adj_cache) {
+    stats.cache_lookups += std::get<0>(t);
+    stats.cache_hits += std::get<1>(t);
+    stats.cache_bytes_saved += std::get<2>(t);
+    t = {};
+  }
+
+  for (auto &t : stats.compressed_reads) {
+    stats.compressed_bytes += t.first;
+    stats.compressed_edges += t.second;
+    t = {};
+  }
+
+  for (auto &t : stats.gathers) {
+    stats.total_gathers += t.first;
+    stats.gathered_wrs += t.second;
+    t = {};
+  }
 }
 
 inline void print_stats_summary(FG_stats const &stats)
@@ -95,6 +242,45 @@ inline void print_stats_summary(FG_stats const &stats)
                                / 10
                           << " WR's: " << stats.wrs << " sends: " << stats.sends
                           << std::endl;
+  BOOST_LOG_TRIVIAL(info) << "Bytes read: " << stats.bytes_read
+                          << " wasted by gap coalescing: " << stats.bytes_wasted
+                          << " WR's saved: " << stats.wrs_saved;
+  BOOST_LOG_TRIVIAL(info) << "Chunk windows for oversized adjacency lists: "
+                          << stats.total_chunk_windows;
+  if (stats.cache_lookups > 0) {
+    BOOST_LOG_TRIVIAL(info) << "Adjacency cache hit rate: "
+                            << static_cast<double>(stats.cache_hits)
+                                 / static_cast<double>(stats.cache_lookups)
+                            << " bytes saved: " << stats.cache_bytes_saved
+                            << " WR's avoided: " << stats.cache_hits;
+  }
+  if (stats.compressed_edges > 0) {
+    BOOST_LOG_TRIVIAL(info) << "Compressed lists: " << stats.compressed_bytes
+                            << " bytes read for " << stats.compressed_edges
+                            << " edges ("
+                            << static_cast<double>(stats.compressed_bytes)
+                                 / static_cast<double>(stats.compressed_edges)
+                            << " bytes/edge)";
+  }
+  if (stats.total_gathers > 0) {
+    BOOST_LOG_TRIVIAL(info) << "Gathers: " << stats.total_gathers << " replacing "
+                            << stats.gathered_wrs << " WR's";
+  }
+  for (int n = 0; n < stats.num_nodes; ++n) {
+    auto const &c = stats.per_node[static_cast<size_t>(n)];
+    if (c.windows == 0) continue;
+    auto const bytes = static_cast<double>(c.bytes.load());
+    BOOST_LOG_TRIVIAL(info) << "NUMA node " << n << ": " << c.bytes << " bytes in "
+                            << c.windows << " windows, "
+                            << bytes / (static_cast<double>(c.busy.load()) / 1e9) / 1e9
+                            << " GB/s per busy worker";
+  }
+  BOOST_LOG_TRIVIAL(info) << "Pipeline depth: " << stats.pipeline_depth;
+  for (uint32_t d = 0; d < stats.pipeline_depth; ++d) {
+    BOOST_LOG_TRIVIAL(info) << "Spin Time (s) with " << d + 1 << " window(s) in flight: "
+                            << static_cast<double>(stats.total_spin_by_depth[d])
+                                 / 1000000000 / 10;
+  }
 }
 
 inline void timespec_diff(struct timespec *a, struct timespec *b, struct timespec *result)
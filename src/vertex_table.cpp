@@ -1,7 +1,21 @@
 #include "vertex_table.hpp"
 
+#include <atomic>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <boost/numeric/conversion/cast.hpp>
 
+#include "edgemap.hpp"// WR, post_all
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+#include <oneapi/tbb.h>
+#pragma GCC diagnostic pop
+
 // this returns a uint32, so we need to do runtime check to assert < 4B verts
 uint32_t famgraph::get_num_verts(std::string const &file)
 {
@@ -38,3 +52,151 @@ uint32_t famgraph::get_max_out_degree(famgraph::vertex *const vtable,
   }
   return my_max;
 }
+
+// Chunks of 8M vertices (64 MiB) are read into a buffer and compacted by one task
+// each. A chunk is read with the next chunk's first offset, where its last list ends.
+famgraph::index_table famgraph::load_index(std::string const &file,
+  uint32_t const num_vertices,
+  uint64_t const num_edges,
+  bool const use_HP)
+{
+  static_assert(sizeof(famgraph::vertex) == sizeof(uint64_t));
+  constexpr uint32_t chunk = 1 << 23;
+  static_assert(chunk % famgraph::compact_index::BLOCK == 0);
+
+  tbb::tick_count const t0 = tbb::tick_count::now();
+  int const fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("can't open index file " + file);
+  auto index =
+    std::make_unique<famgraph::compact_index>(num_vertices, num_edges, use_HP);
+  tbb::combinable<uint32_t> max_degree{ [] { return 0u; } };
+  tbb::enumerable_thread_specific<std::vector<uint64_t>> buffers;
+  std::atomic<bool> failed{ false };
+
+  uint64_t const num_chunks = (uint64_t{ num_vertices } + chunk - 1) / chunk;
+  tbb::parallel_for(uint64_t{ 0 }, num_chunks, [&](uint64_t const c) {
+    uint64_t const begin = c * chunk;
+    uint64_t const end = std::min(begin + chunk, uint64_t{ num_vertices });
+    auto &buf = buffers.local();
+    buf.resize(end - begin + (end < num_vertices ? 1 : 0));
+    auto *const dst = reinterpret_cast<char *>(buf.data());
+    auto const bytes = buf.size() * sizeof(uint64_t);
+    auto const base = static_cast<off_t>(begin * sizeof(uint64_t));
+    for (size_t done = 0; done < bytes;) {
+      auto const r = pread(fd, dst + done, bytes - done, base + static_cast<off_t>(done));
+      if (r <= 0) {
+        failed = true;
+        return;
+      }
+      done += static_cast<size_t>(r);
+    }
+    auto const next = end < num_vertices ? buf[end - begin] : num_edges;
+    auto const my_max = index->fill(
+      static_cast<uint32_t>(begin), static_cast<uint32_t>(end), buf.data(), next);
+    max_degree.local() = std::max(max_degree.local(), my_max);
+  });
+  close(fd);
+  if (failed) throw std::runtime_error("can't read index data");
+
+  uint32_t const my_max =
+    max_degree.combine([](uint32_t const a, uint32_t const b) { return std::max(a, b); });
+
+  double const seconds = (tbb::tick_count::now() - t0).seconds();
+  BOOST_LOG_TRIVIAL(info) << "loaded " << file << ": " << num_vertices << " vertices in "
+                          << seconds << " s ("
+                          << static_cast<double>(num_vertices * sizeof(uint64_t))
+                               / seconds / 1e9
+                          << " GB/s), max out degree " << my_max << ", "
+                          << (index->bytes() >> 20) << " MiB compacted";
+  return { std::move(index), my_max };
+}
+
+// Worker w's QP reads the w'th slice of the index in READs of up to FETCH_READ bytes,
+// FETCH_CHAIN of them posted at a time. The offsets land in a temporary array and are
+// compacted from there; the largest degree is found while compacting if the catalog
+// does not give it.
+famgraph::index_table famgraph::fetch_index(client_context &ctx,
+  uint32_t const server,
+  named_region const &region,
+  uint32_t const num_vertices,
+  uint64_t const num_edges,
+  uint32_t const max_out_degree,
+  bool const use_HP)
+{
+  constexpr uint64_t FETCH_READ = 1 << 20;
+  constexpr size_t FETCH_CHAIN = 16;
+
+  uint64_t const bytes = uint64_t{ num_vertices } * sizeof(famgraph::vertex);
+  if (region.bytes < bytes) throw std::runtime_error("remote index is too short");
+
+  tbb::tick_count const t0 = tbb::tick_count::now();
+  auto offsets = famgraph::mmap_unique<uint64_t>(num_vertices, false);
+  auto *const dst = reinterpret_cast<char *>(offsets.get());
+  // registered only for the transfer
+  auto *const mr = ibv_reg_mr(ctx.pd, dst, bytes, IBV_ACCESS_LOCAL_WRITE);
+  if (!mr) throw std::runtime_error("can't register the index");
+
+  auto const workers = ctx.workers;
+  tbb::parallel_for(size_t{ 0 }, workers, [&](size_t const w) {
+    auto const qp = ctx.data_qp(w, server);
+    auto *const id = ctx.cm_ids[qp];
+    auto &ring = ctx.rings[qp];
+    uint64_t const end = bytes * (w + 1) / workers;
+    std::vector<WR> WRs;
+    for (uint64_t pos = bytes * w / workers; pos < end;) {
+      auto const len = std::min(FETCH_READ, end - pos);
+      WRs.emplace_back();
+      auto &wr = WRs.back().wr;
+      auto &sge = WRs.back().sge;
+      memset(&wr, 0, sizeof(wr));
+      wr.opcode = IBV_WR_RDMA_READ;
+      wr.wr.rdma.remote_addr = region.addr + pos;
+      wr.wr.rdma.rkey = region.rkey;
+      wr.sg_list = &sge;
+      wr.num_sge = 1;
+      sge.addr = reinterpret_cast<uintptr_t>(dst + pos);
+      sge.length = static_cast<uint32_t>(len);
+      sge.lkey = mr->lkey;
+      pos += len;
+      if (WRs.size() == FETCH_CHAIN || pos == end) {
+        auto const seq = famgraph::post_all(WRs, id->qp, FETCH_CHAIN, ring);
+        famgraph::wait_for_completion(id, ring, seq, false);
+        WRs.clear();
+      }
+    }
+  });
+  ibv_dereg_mr(mr);
+
+  constexpr uint32_t chunk = 1 << 23;
+  auto index =
+    std::make_unique<famgraph::compact_index>(num_vertices, num_edges, use_HP);
+  auto const *const raw = offsets.get();
+  uint32_t const my_max = tbb::parallel_reduce(
+    tbb::blocked_range<uint64_t>(0, (uint64_t{ num_vertices } + chunk - 1) / chunk),
+    0u,
+    [&](tbb::blocked_range<uint64_t> const &r, uint32_t m) {
+      for (auto c = r.begin(); c < r.end(); ++c) {
+        uint64_t const begin = c * chunk;
+        uint64_t const end = std::min(begin + chunk, uint64_t{ num_vertices });
+        auto const next = end < num_vertices ? raw[end] : num_edges;
+        m = std::max(m,
+          index->fill(static_cast<uint32_t>(begin),
+            static_cast<uint32_t>(end),
+            raw + begin,
+            next));
+      }
+      return m;
+    },
+    [](uint32_t const a, uint32_t const b) { return std::max(a, b); });
+
+  double const seconds = (tbb::tick_count::now() - t0).seconds();
+  BOOST_LOG_TRIVIAL(info) << "fetched the index from server " << server << ": "
+                          << num_vertices << " vertices in " << seconds << " s ("
+                          << static_cast<double>(bytes) / seconds / 1e9
+                          << " GB/s), max out degree " << my_max << ", "
+                          << (index->bytes() >> 20) << " MiB compacted";
+  if (max_out_degree && max_out_degree != my_max) {
+    BOOST_LOG_TRIVIAL(warning) << "the catalog gives max out degree " << max_out_degree;
+  }
+  return { std::move(index), my_max };
+}
@@ -14,6 +14,7 @@
 
 #include <client_runtime.hpp>
 
+#include "index_table.hpp"
 #include "mmap_util.hpp"
 
 namespace famgraph {
@@ -24,44 +25,46 @@ uint32_t get_num_edges(uint32_t const v,
   uint32_t const total_verts,
   uint64_t const total_edges) noexcept;
 
+// The same, for a compacted index.
+inline uint32_t get_num_edges(uint32_t const v,
+  famgraph::compact_index const *const index,
+  uint32_t const,
+  uint64_t const) noexcept
+{
+  return index->degree(v);
+}
+
 uint32_t get_max_out_degree(famgraph::vertex *const vtable,
   uint32_t const n_vert,
   uint64_t const n_edges) noexcept;
 
-template<typename V>
-auto get_vertex_table(std::string const &file,
+// Reads the header of a .cidx file: the edge count of the compressed graph.
+inline uint64_t get_compressed_num_edges(std::string const &file)
+{
+  std::ifstream input(file, std::ios::binary);
+  if (!input) throw std::runtime_error("can't open compressed index");
+  uint64_t num_edges;
+  input.read(reinterpret_cast<char *>(&num_edges), sizeof(num_edges));
+  if (!input) throw std::runtime_error("can't read compressed index");
+  return num_edges;
+}
+
+// Reads the num_vertices + 1 byte offsets of a .cidx file (see adjacency_codec.hpp).
+inline auto get_byte_index(std::string const &file,
   uint64_t const num_vertices,
   bool const use_HP)
 {
-  namespace fs = boost::filesystem;
-  fs::path p(file);
-  if (fs::exists(p) && fs::is_regular_file(p)) {
-    std::ifstream input(p.c_str(), std::ios::binary);
-    if (input) {
-      uint64_t a;
-      auto pt = mmap_unique<famgraph::vertex>(num_vertices, use_HP);
-      auto pt2 = mmap_unique<V>(num_vertices, use_HP);
-      auto *vp = pt.get();
-      for (uint64_t i = 0; i < num_vertices; ++i) {
-        input.read(reinterpret_cast<char *>(&a), sizeof(uint64_t));
-        // std::cout << a << std::endl;
-        vp[i].edge_offset = a;
-        if (static_cast<unsigned long>(input.gcount()) != sizeof(uint64_t)) {
-          throw std::runtime_error("can't read index data");
-        }
-      }
-      return std::make_pair(std::move(pt), std::move(pt2));
-    }
-    throw std::runtime_error("stream open error");
-  }
-  throw std::runtime_error("file not found");
-  // do file I/O to get data
-  // allocate table with MMAP
-  // register memory for RDMA
-  // use new to create array<V>
-  // figure out deleter function situation
-  // return unique ptr
+  std::ifstream input(file, std::ios::binary);
+  if (!input) throw std::runtime_error("can't open compressed index");
+  input.seekg(sizeof(uint64_t));
+
+  auto pt = mmap_unique<uint64_t>(num_vertices + 1, use_HP);
+  auto const bytes = static_cast<std::streamsize>((num_vertices + 1) * sizeof(uint64_t));
+  input.read(reinterpret_cast<char *>(pt.get()), bytes);
+  if (input.gcount() != bytes) throw std::runtime_error("can't read compressed index");
+  return pt;
 }
+
 }// namespace famgraph
 
 #endif// __PROJ_VERTEX_TABLE_H__
@@ -1,6 +1,159 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "adjacency_codec.hpp"
+#include "compact_index.hpp"
+
 TEST_CASE("TEST HERE", "[None]")
 {
   REQUIRE(1 == 1);
 }
+
+namespace {
+// An ascending list of n edges whose gaps cycle through 1, 2, 3 and 4 byte codes.
+std::vector<uint32_t> mixed_gap_list(uint32_t const n)
+{
+  std::vector<uint32_t> edges;
+  uint32_t prev = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t gap;
+    switch (i % 8) {
+    case 0:
+    case 1: gap = 1 + i % 200; break;
+    case 2:
+    case 3: gap = 256 + i % 1000; break;
+    case 4:
+    case 5: gap = 65536 + i; break;
+    case 6: gap = 1; break;
+    default: gap = i % 512 == 7 ? (1u << 24) + i : 5; break;
+    }
+    prev += gap;
+    edges.push_back(prev);
+  }
+  return edges;
+}
+}// namespace
+
+TEST_CASE("adjacency lists survive an encode/decode round trip", "[codec]")
+{
+  namespace codec = famgraph::codec;
+  auto const n = GENERATE(0u, 1u, 3u, 4u, 5u, 7u, 8u, 13u, 100u, 10000u);
+  auto const edges = mixed_gap_list(n);
+
+  std::vector<uint8_t> encoded;
+  codec::encode_list(edges.data(), n, encoded);
+
+  // every frame but the last is padded to FRAME_BYTES
+  uint32_t counted = 0;
+  for (uint64_t pos = 0; pos < encoded.size(); pos += codec::FRAME_BYTES) {
+    uint16_t count;
+    std::memcpy(&count, encoded.data() + pos, sizeof(count));
+    REQUIRE(count > 0);
+    counted += count;
+  }
+  REQUIRE(counted == n);
+  if (n == 10000) REQUIRE(encoded.size() > 4 * codec::FRAME_BYTES);
+
+  SECTION("as a whole list")
+  {
+    std::vector<uint32_t> decoded(n);
+    codec::decode_list(encoded.data(), encoded.size(), decoded.data(), n);
+    REQUIRE(decoded == edges);
+  }
+
+  SECTION("frame by frame, with and without room for 16 byte loads")
+  {
+    std::vector<uint32_t> wide(n);
+    std::vector<uint32_t> scalar(n);
+    uint32_t got = 0;
+    for (uint64_t pos = 0; got < n; pos += codec::FRAME_BYTES) {
+      // no bytes available forces the scalar loop over the whole frame
+      auto const *const frame = encoded.data() + pos;
+      auto const count = codec::decode_frame(frame, 0, scalar.data() + got);
+      auto const avail = encoded.size() - pos;
+      REQUIRE(codec::decode_frame(frame, avail, wide.data() + got) == count);
+      got += count;
+    }
+    REQUIRE(scalar == edges);
+    REQUIRE(wide == edges);
+  }
+}
+
+namespace {
+// Checks idx against the raw offsets of its vertices, where m ends the last list.
+void require_matches(famgraph::compact_index const &idx,
+  std::vector<uint64_t> const &offsets,
+  uint64_t const m)
+{
+  for (uint32_t v = 0; v < idx.num_vertices(); ++v) {
+    auto const end = v + 1 < offsets.size() ? offsets[v + 1] : m;
+    REQUIRE(idx.offset(v) == offsets[v]);
+    REQUIRE(idx.degree(v) == end - offsets[v]);
+  }
+}
+}// namespace
+
+TEST_CASE("compact index reproduces the raw offsets", "[compact_index]")
+{
+  using famgraph::compact_index;
+  uint32_t const n = 3 * compact_index::BLOCK + 5;// a partial last block
+
+  // degrees around DEGREE_ESCAPE, including empty lists, and a large last list
+  std::vector<uint64_t> offsets(n);
+  uint64_t next = 0;
+  uint32_t max_degree = 0;
+  for (uint32_t v = 0; v < n; ++v) {
+    offsets[v] = next;
+    uint32_t const d = v + 1 == n ? 1000 : (v * 37) % 300;
+    max_degree = std::max(max_degree, d);
+    next += d;
+  }
+  uint64_t const m = next;
+
+  compact_index idx{ n, m, false };
+  REQUIRE(idx.num_blocks() == 4);
+  SECTION("filled at once")
+  {
+    REQUIRE(idx.fill(0, n, offsets.data(), m) == max_degree);
+  }
+  SECTION("filled in block-aligned chunks")
+  {
+    auto const mid = 2 * compact_index::BLOCK;
+    auto const low = idx.fill(0, mid, offsets.data(), offsets[mid]);
+    auto const high = idx.fill(mid, n, offsets.data() + mid, m);
+    REQUIRE(std::max(low, high) == max_degree);
+  }
+  require_matches(idx, offsets, m);
+  REQUIRE(idx.degree(n - 1) == 1000);
+}
+
+TEST_CASE("compact index keeps blocks spanning 64K edges wide", "[compact_index]")
+{
+  using famgraph::compact_index;
+  uint32_t const n = 2 * compact_index::BLOCK + 3;
+
+  // the first list of each block sets its span: one edge short of 64K, 64K and 3G
+  std::vector<uint64_t> offsets(n);
+  uint64_t next = 0;
+  for (uint32_t v = 0; v < n; ++v) {
+    offsets[v] = next;
+    switch (v) {
+    case 0: next += 0xffff; break;
+    case compact_index::BLOCK: next += 0x10000; break;
+    case 2 * compact_index::BLOCK: next += uint64_t{ 3 } << 30; break;
+    default: break;// the other lists are empty
+    }
+  }
+  uint64_t const m = next;
+
+  compact_index idx{ n, m, false };
+  auto const narrow = idx.bytes();
+  REQUIRE(idx.fill(0, n, offsets.data(), m) == uint32_t{ 3 } << 30);
+  // the last two blocks hold full offsets
+  REQUIRE(idx.bytes() == narrow + (compact_index::BLOCK + 3) * sizeof(uint64_t));
+  require_matches(idx, offsets, m);
+}
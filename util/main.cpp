@@ -9,6 +9,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include "adjacency_codec.hpp"
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wall"
 #pragma GCC diagnostic ignored "-Wunknown-pragmas"
@@ -102,12 +104,14 @@ struct w_csr_graph edge_list_to_w_csr(vector<std::tuple<uint32_t,uint32_t,float>
 
 void encode_weighted(fs::path const &p, fs::path const &index, fs::path const &adj, po::variables_map const& vm){
     bool make_undirected = vm.count("make-undirected") ? true : false;
+    bool transpose = vm.count("transpose") ? true : false;
     fs::ifstream ifs(p);
     uint32_t a, b;
     float c;
     std::vector<std::tuple<uint32_t, uint32_t, float>> v;
     uint32_t max_vert = 0;
     while (ifs >> a >> b >> c){
+        if (transpose) std::swap(a, b);
         v.push_back(std::make_tuple(a, b, c));
         if (make_undirected){
             v.push_back(std::make_tuple(b, a, c));
@@ -169,13 +173,52 @@ struct csr_graph edge_list_to_csr(vector<std::pair<uint32_t,uint32_t>> const & v
     return csr_graph(std::move(idx), std::move(dest));
 }
 
+// Writes g as a .cidx/.cadj pair, see src/adjacency_codec.hpp. Lists are sorted
+// before delta coding, so their order may differ from the .adj file.
+void write_compressed(csr_graph const &g, fs::path const &cidx, fs::path const &cadj){
+    uint64_t const n = g.index.size();
+    uint64_t const num_edges = g.dest.size();
+    fs::ofstream cidx_ostream(cidx);
+    fs::ofstream cadj_ostream(cadj);
+    cidx_ostream.write((char*)&num_edges, sizeof(num_edges));
+
+    uint64_t offset = 0;
+    std::vector<uint32_t> list;
+    std::vector<uint8_t> bytes;
+    for (uint64_t v = 0; v < n; ++v){
+        uint64_t const start = g.index[v];
+        uint64_t const end = v == n - 1 ? num_edges : g.index[v + 1];
+        list.assign(g.dest.begin() + static_cast<long>(start),
+            g.dest.begin() + static_cast<long>(end));
+        std::sort(list.begin(), list.end());
+        bytes.clear();
+        famgraph::codec::encode_list(list.data(), static_cast<uint32_t>(list.size()), bytes);
+
+        cidx_ostream.write((char*)&offset, sizeof(offset));
+        cadj_ostream.write((char*)bytes.data(), static_cast<long>(bytes.size()));
+        offset += bytes.size();
+    }
+    cidx_ostream.write((char*)&offset, sizeof(offset));
+
+    // the server registers the edge file in 4 byte words
+    uint32_t const zero = 0;
+    cadj_ostream.write((char*)&zero, static_cast<long>((4 - offset % 4) % 4));
+
+    BOOST_LOG_TRIVIAL(info) << "Compressed " << num_edges << " edges into " << offset
+                            << " bytes";
+    cidx_ostream.close();
+    cadj_ostream.close();
+}
+
 void encode_unweighted(fs::path const &p, fs::path const &index, fs::path const &adj, po::variables_map const& vm){
     bool make_undirected = vm.count("make-undirected") ? true : false;
+    bool transpose = vm.count("transpose") ? true : false;
     fs::ifstream ifs(p);
     uint32_t a, b;
     std::vector<std::pair<uint32_t, uint32_t>> v;
     uint32_t max_vert = 0;
     while (ifs >> a >> b){
+        if (transpose) std::swap(a, b);
         v.push_back(std::make_pair(a, b));
         if (make_undirected){
             v.push_back(std::make_pair(b,a));
@@ -216,6 +259,11 @@ void encode_unweighted(fs::path const &p, fs::path const &index, fs::path const
     
     index_ostream.close();
     adj_ostream.close();
+
+    if (vm.count("compress")){
+        fs::path cidx(index), cadj(adj);
+        write_compressed(g, cidx.replace_extension(".cidx"), cadj.replace_extension(".cadj"));
+    }
 }
 
 int main(int argc, char * argv[])
@@ -229,6 +277,8 @@ int main(int argc, char * argv[])
             ("sorted,s", "set if input edgelist is sorted by origin vertex")
             ("weighted,w", "graph has floating point edge weight")
             ("make-undirected", "add a reverse edge for each edge in the list")
+            ("transpose", "reverse every edge, producing the in-edge CSR")
+            ("compress", "also write a compressed .cidx/.cadj pair (unweighted only)")
             ;
         po::variables_map vm;
         po::store(po::parse_command_line(argc,argv,desc), vm);
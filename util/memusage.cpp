@@ -56,7 +56,11 @@ int main(int argc, char *argv[])
       "infile,i", po::value<std::string>(), "input filepath")(
       "threads,t", po::value<uint64_t>()->default_value(40), "# of FG threads")(
       "vertsize", po::value<uint64_t>()->default_value(4), "B per vertex")(
-      "edgewindow", po::value<uint64_t>()->default_value(1), "EW multiplier");
+      "edgewindow", po::value<uint64_t>()->default_value(1), "EW multiplier")(
+      "window-edges",
+      po::value<uint64_t>()->default_value(1 << 20),
+      "cap on edges per window")(
+      "pipeline-depth", po::value<uint64_t>()->default_value(1), "windows per thread");
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
@@ -76,11 +80,14 @@ int main(int argc, char *argv[])
       auto const verts = num_elements<uint64_t>(index);
       auto const max = max_degree(index);
       auto const ew = vm["edgewindow"].as<uint64_t>();
+      auto const window = std::min(max * ew, vm["window-edges"].as<uint64_t>());
+      auto const depth = vm["pipeline-depth"].as<uint64_t>();
       BOOST_LOG_TRIVIAL(info) << "|V| = " << verts;
       BOOST_LOG_TRIVIAL(info) << "Max outdegree = " << max;
       BOOST_LOG_TRIVIAL(info) << "# of threads = " << threads;
       BOOST_LOG_TRIVIAL(info) << "B per vertex = " << B;
-      auto const total = (8 + B) * verts + 4 * max * threads * ew;
+      BOOST_LOG_TRIVIAL(info) << "Edges per window = " << window;
+      auto const total = (8 + B) * verts + 4 * window * threads * depth;
       BOOST_LOG_TRIVIAL(info) << "Total memory usage = "
                               << (static_cast<double>(total) / (1 << 30)) << "GB";
     } else {